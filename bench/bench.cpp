@@ -0,0 +1,391 @@
+/**
+ *  MIT License
+ *
+ *  Copyright (c) Dmitry Makarenko 2019
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+// Usage: bench [--scale MB] [--repeat N] [--filter text] [--json file|-]
+//
+// Every benchmark runs --repeat times on the same deterministic input and
+// the fastest run is reported, throughput is payload bytes per second.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "corpus.h"
+#include "intelhex.h"
+#include "intelhex_decode.h"
+
+using namespace IntelHexNS;
+
+namespace {
+
+struct Options
+{
+    uint32_t scale  = 16; // MB of payload in the dense images
+    int repeat      = 5;
+    std::string filter;
+    std::string json;
+};
+
+struct Measurement
+{
+    std::string name;
+    uint64_t bytes;   // payload processed by one run, 0 when throughput makes no sense
+    uint64_t ops;     // operations in one run
+    double seconds;   // fastest run
+};
+
+// Intel HEX text in memory, payload bytes come from a fixed seed
+std::string synthesize(uint64_t size, uint8_t lineWidth, uint32_t chunk = 0, uint32_t gap = 0)
+{
+    CorpusOptions options;
+    options.size      = size;
+    options.lineWidth = lineWidth;
+    options.chunk     = chunk;
+    options.gap       = gap;
+    std::ostringstream output;
+    generateCorpus(options, output);
+    return output.str();
+}
+
+class Runner {
+public:
+    explicit Runner(const Options &options)
+        : m_options(options)
+    {
+    }
+
+    // body runs once per repeat, prepare runs before it and is not timed,
+    // false when the filter skipped the benchmark
+    bool run(const std::string &name,
+             uint64_t bytes,
+             uint64_t ops,
+             const std::function<void()> &body,
+             const std::function<void()> &prepare = nullptr)
+    {
+        if (!m_options.filter.empty() && name.find(m_options.filter) == std::string::npos)
+            return false;
+
+        double best = 0;
+        for (int i = 0; i < m_options.repeat; i++) {
+            if (prepare)
+                prepare();
+            auto start = std::chrono::steady_clock::now();
+            body();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (i == 0 || elapsed.count() < best)
+                best = elapsed.count();
+        }
+        m_results.push_back({name, bytes, ops, best});
+        print(m_results.back());
+        return true;
+    }
+
+    void writeJson(std::ostream &output) const
+    {
+        output << "{\n  \"scale_mb\": " << m_options.scale << ",\n  \"repeat\": " << m_options.repeat
+               << ",\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < m_results.size(); i++) {
+            const auto &result = m_results[i];
+            output << "    {\"name\": \"" << result.name << "\", \"bytes\": " << result.bytes
+                   << ", \"ops\": " << result.ops << ", \"seconds\": " << result.seconds
+                   << ", \"mb_per_s\": " << mbPerSecond(result) << ", \"ns_per_op\": " << nsPerOp(result)
+                   << "}" << (i + 1 < m_results.size() ? "," : "") << "\n";
+        }
+        output << "  ]\n}\n";
+    }
+
+private:
+    static double mbPerSecond(const Measurement &result)
+    {
+        return result.seconds > 0 ? result.bytes / result.seconds / 1e6 : 0;
+    }
+
+    static double nsPerOp(const Measurement &result)
+    {
+        return result.ops > 0 ? result.seconds * 1e9 / result.ops : 0;
+    }
+
+    static void print(const Measurement &result)
+    {
+        std::cout << std::left << std::setw(28) << result.name << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(12) << mbPerSecond(result) << " MB/s"
+                  << std::setw(14) << nsPerOp(result) << " ns/op" << std::endl;
+    }
+
+    const Options &m_options;
+    std::vector<Measurement> m_results;
+};
+
+// addresses inside the populated part of the image, same sequence on every run
+std::vector<uint32_t> randomAddresses(const IntelHex &hex, size_t count)
+{
+    std::mt19937 random(0xADD5);
+    std::uniform_int_distribution<uint32_t> distribution(hex.minAddress(), hex.maxAddress());
+    std::vector<uint32_t> addresses(count);
+    for (auto &address : addresses)
+        address = distribution(random);
+    return addresses;
+}
+
+// A save is only worth timing if its output loads back as the same image
+bool savedIntact(const IntelHex &image, const fs::path &path, const std::string &name)
+{
+    IntelHex loaded;
+    if (loaded.load(path) == IntelHex::Result::SUCCESS && IntelHex::diff(image, loaded).empty())
+        return true;
+    std::cerr << name << ": saved file does not load back as the saved image" << std::endl;
+    return false;
+}
+
+bool parseOptions(int argc, char **argv, Options &options)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        if (arg == "--scale")
+            options.scale = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--repeat")
+            options.repeat = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--filter")
+            options.filter = argv[++i];
+        else if (arg == "--json")
+            options.json = argv[++i];
+        else
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "usage: bench [--scale MB] [--repeat N] [--filter text] [--json file|-]" << std::endl;
+        return 1;
+    }
+
+    Runner runner(options);
+    const uint64_t payload = uint64_t(options.scale) << 20;
+
+    // record data decode alone, the generic loop against the fixed width dispatch,
+    // on a cache sized buffer decoded over and over, so memory bandwidth does not hide the difference
+    volatile uint8_t sink = 0;
+    std::string digits(1 << 19, '0');
+    const uint64_t passes = std::max<uint64_t>(1, payload / (digits.size() / 2));
+    std::mt19937 random(0xDEC0DE);
+    for (auto &digit : digits)
+        digit = "0123456789ABCDEF"[random() & 0x0F];
+    for (uint8_t width : {16, 32, 64}) {
+        // read back through volatile so the generic loop does not see a constant length
+        volatile uint8_t runtimeWidth = width;
+        auto decode = [&](auto decodeRecord) {
+            uint8_t length  = runtimeWidth;
+            uint8_t invalid = 0;
+            uint8_t sum     = 0;
+            uint8_t out[255];
+            for (uint64_t pass = 0; pass < passes; pass++) {
+                for (size_t pos = 0; pos + length * 2 <= digits.size(); pos += length * 2) {
+                    sum += decodeRecord(digits.data() + pos, out, length, invalid);
+                }
+            }
+            sink = sum ^ invalid;
+        };
+        // lambdas rather than function pointers, so both variants are inlined
+        runner.run("decode/generic/" + std::to_string(width), payload, payload / width, [&] {
+            decode([](const char *str, uint8_t *out, uint8_t length, uint8_t &invalid) {
+                return Hex::decodeData(str, out, length, invalid);
+            });
+        });
+        runner.run("decode/fixed/" + std::to_string(width), payload, payload / width, [&] {
+            decode([](const char *str, uint8_t *out, uint8_t length, uint8_t &invalid) {
+                return Hex::decodePayload(str, out, length, invalid);
+            });
+        });
+    }
+
+    // parsing, dense images at the common line widths, 24 takes the generic decode path
+    for (uint8_t width : {16, 24, 32, 64, 255}) {
+        std::string text = synthesize(payload, width);
+        runner.run("loads/dense/" + std::to_string(width), payload, payload / width, [&] {
+            IntelHex hex;
+            hex.loads(text, IntelHex::Format::INTEL_HEX);
+        });
+    }
+
+    // 256 byte chunks every 4K, one block per chunk
+    std::string sparse = synthesize(payload / 16, 16, 256, 4096 - 256);
+    runner.run("loads/sparse", payload / 16, payload / 16 / 16, [&] {
+        IntelHex hex;
+        hex.loads(sparse, IntelHex::Format::INTEL_HEX);
+    });
+
+    // 64 bytes per 64K page, a type 04 record every four data records
+    std::string paged = synthesize(payload / 64, 16, 64, 0x10000 - 64);
+    runner.run("loads/ext-linear", payload / 64, payload / 64 / 16, [&] {
+        IntelHex hex;
+        hex.loads(paged, IntelHex::Format::INTEL_HEX);
+    });
+
+    std::string dense = synthesize(payload, 16);
+    fs::path path     = fs::temp_directory_path() / "intelhex_bench.hex";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << dense;
+    }
+    runner.run("load/dense/16", payload, payload / 16, [&] {
+        IntelHex hex;
+        hex.load(path, IntelHex::Format::INTEL_HEX);
+    });
+
+    // the native image is mapped, reading it back in full shows the page faults
+    fs::path native = fs::temp_directory_path() / "intelhex_bench.ihxn";
+    {
+        IntelHex hex;
+        hex.loads(dense, IntelHex::Format::INTEL_HEX);
+        hex.save(native, IntelHex::Format::NATIVE);
+        if (runner.run("save/native", payload, 1, [&] { hex.save(native, IntelHex::Format::NATIVE); }) &&
+            !savedIntact(hex, native, "save/native"))
+            return 1;
+    }
+    runner.run("load/native", payload, 1, [&] {
+        IntelHex hex;
+        hex.load(native);
+        uint8_t sum = 0;
+        for (uint32_t address = hex.minAddress(); address <= hex.maxAddress(); address += 64)
+            sum += hex.get(address);
+        sink = sum;
+    });
+    fs::remove(native);
+
+    IntelHex image;
+    image.loads(dense, IntelHex::Format::INTEL_HEX);
+    for (uint8_t width : {16, 32, 255}) {
+        image.setLineWidth(width);
+        std::string name = "save/dense/" + std::to_string(width);
+        if (runner.run(name, payload, payload / width, [&] { image.save(path, IntelHex::Format::INTEL_HEX); }) &&
+            !savedIntact(image, path, name))
+            return 1;
+    }
+    image.setLineWidth(16);
+
+    IntelHex sparseImage;
+    sparseImage.loads(sparse, IntelHex::Format::INTEL_HEX);
+    bool saved = runner.run("save/sparse", payload / 16, payload / 16 / 16, [&] {
+        sparseImage.save(path, IntelHex::Format::INTEL_HEX);
+    });
+    if (saved && !savedIntact(sparseImage, path, "save/sparse"))
+        return 1;
+    fs::remove(path);
+
+    // access, the checksum keeps the reads from being optimized away
+    runner.run("get/sequential", payload, payload, [&] {
+        uint8_t sum = 0;
+        for (uint32_t address = image.minAddress(); address <= image.maxAddress(); address++)
+            sum += image.get(address);
+        sink = sum;
+    });
+
+    auto addresses = randomAddresses(image, 1 << 20);
+    runner.run("get/random", 0, addresses.size(), [&] {
+        uint8_t sum = 0;
+        for (auto address : addresses)
+            sum += image.get(address);
+        sink = sum;
+    });
+
+    auto sparseAddresses = randomAddresses(sparseImage, 1 << 16);
+    runner.run("get/random-sparse", 0, sparseAddresses.size(), [&] {
+        uint8_t sum = 0;
+        for (auto address : sparseAddresses)
+            sum += sparseImage.get(address);
+        sink = sum;
+    });
+
+    runner.run("operator[]/sequential", payload, payload, [&] {
+        for (uint32_t address = image.minAddress(); address <= image.maxAddress(); address++)
+            image[address] ^= 0x5A;
+    });
+
+    runner.run("operator[]/random", 0, addresses.size(), [&] {
+        for (auto address : addresses)
+            image[address] ^= 0x5A;
+    });
+
+    runner.run("copy/dense", payload, 1, [&] {
+        IntelHex copy(image);
+        sink = copy.get(0);
+    });
+
+    runner.run("copy/sparse", payload / 16, 1, [&] {
+        IntelHex copy(sparseImage);
+        sink = copy.get(0);
+    });
+
+    // punching 256 byte holes every 64K, each run works on a fresh copy
+    IntelHex victim;
+    const uint32_t holes = uint32_t(payload >> 16);
+    runner.run(
+        "erase/holes", 0, holes,
+        [&] {
+            for (uint32_t i = 0; i < holes; i++)
+                victim.erase(i << 16, 256);
+        },
+        [&] { victim = image; });
+
+    // a one byte change every 4K, each run patches a fresh copy
+    IntelHex changed = image;
+    for (uint32_t address = image.minAddress(); address <= image.maxAddress(); address += 4096)
+        changed[address] ^= 0xFF;
+    auto patch = IntelHex::makePatch(image, changed);
+    runner.run(
+        "apply/scattered", 0, patch.records.size(), [&] { victim.apply(patch); }, [&] { victim = image; });
+
+    // the same scattered bytes as an image of their own, overwriting a fresh copy each run
+    IntelHex scattered;
+    for (uint32_t address = image.minAddress(); address <= image.maxAddress(); address += 4096)
+        scattered[address] = 0;
+    runner.run(
+        "merge/scattered", 0, patch.records.size(),
+        [&] { victim.merge(scattered, IntelHex::MergePolicy::OVERWRITE); }, [&] { victim = image; });
+
+    if (!options.json.empty()) {
+        if (options.json == "-") {
+            runner.writeJson(std::cout);
+        }
+        else {
+            std::ofstream file(options.json);
+            runner.writeJson(file);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,163 @@
+/**
+ *  MIT License
+ *
+ *  Copyright (c) Dmitry Makarenko 2019
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "corpus.h"
+#include <algorithm>
+#include <string>
+
+namespace IntelHexNS {
+
+namespace {
+
+// xorshift64*, fixed so corpora do not depend on the standard library
+class Random {
+public:
+    explicit Random(uint32_t seed)
+        : m_state(0x9E3779B97F4A7C15ull ^ seed)
+    {
+    }
+
+    uint64_t next()
+    {
+        m_state ^= m_state >> 12;
+        m_state ^= m_state << 25;
+        m_state ^= m_state >> 27;
+        return m_state * 0x2545F4914F6CDD1Dull;
+    }
+
+    // uniform in [0, 1)
+    double real()
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+private:
+    uint64_t m_state;
+};
+
+void appendByte(std::string &line, uint8_t value)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    line += digits[value >> 4];
+    line += digits[value & 0x0F];
+}
+
+void encodeRecord(std::string &line, uint8_t type, uint16_t address, const uint8_t *data, uint8_t length)
+{
+    uint8_t sum = length + (address >> 8) + address + type;
+    line        = ':';
+    appendByte(line, length);
+    appendByte(line, address >> 8);
+    appendByte(line, address & 0xFF);
+    appendByte(line, type);
+    for (int i = 0; i < length; i++) {
+        appendByte(line, data[i]);
+        sum += data[i];
+    }
+    appendByte(line, uint8_t(-sum));
+}
+
+void corrupt(std::string &line, Random &random)
+{
+    // never touching the length field, so the damaged range stays known
+    size_t position = 9 + random.next() % (line.size() - 9);
+    switch (random.next() % 4) {
+    case 0:
+        // a different digit keeps the line well formed but breaks the checksum
+        line[position] = line[position] == '0' ? '1' : '0';
+        break;
+    case 1:
+        // only strict parsing catches it when the digit was a zero
+        line[position] = 'G';
+        break;
+    case 2:
+        line.erase(position, 1);
+        break;
+    default:
+        line[0] = ';';
+        break;
+    }
+}
+
+} // namespace
+
+CorpusStats generateCorpus(const CorpusOptions &options, std::ostream &output)
+{
+    CorpusStats stats;
+    Random random(options.seed);
+    uint8_t width  = std::max<uint8_t>(options.lineWidth, 1);
+    uint64_t chunk = options.chunk ? options.chunk : options.size;
+
+    std::string line;
+    uint8_t data[255];
+    uint64_t address       = options.start;
+    uint64_t page          = 0;
+    uint64_t sinceExtended = 0;
+
+    auto emit = [&]() {
+        line += '\n';
+        output.write(line.data(), line.size());
+        stats.records++;
+    };
+
+    while (stats.payload < options.size && address <= 0xFFFFFFFF) {
+        uint64_t end = std::min<uint64_t>(address + std::min(chunk, options.size - stats.payload), 0x100000000ull);
+        while (address < end) {
+            if (address >> 16 != page || (options.extendedEvery && sinceExtended >= options.extendedEvery) ||
+                stats.records == 0) {
+                page             = address >> 16;
+                uint8_t upper[2] = {uint8_t(page >> 8), uint8_t(page)};
+                encodeRecord(line, 0x04, 0, upper, 2);
+                emit();
+                stats.extended++;
+                sinceExtended = 0;
+            }
+
+            // records do not cross 64K pages
+            uint64_t pageEnd = (page + 1) << 16;
+            uint8_t length   = uint8_t(std::min<uint64_t>({width, end - address, pageEnd - address}));
+            for (int i = 0; i < length; i += 8) {
+                uint64_t value = random.next();
+                for (int j = i; j < length && j < i + 8; j++, value >>= 8)
+                    data[j] = uint8_t(value);
+            }
+            encodeRecord(line, 0x00, uint16_t(address), data, length);
+            if (options.errorRate > 0 && random.real() < options.errorRate) {
+                corrupt(line, random);
+                stats.corrupted++;
+            }
+            emit();
+            sinceExtended++;
+            address += length;
+            stats.payload += length;
+        }
+        address += options.gap;
+    }
+
+    line = ":00000001FF";
+    emit();
+    return stats;
+}
+
+} // namespace IntelHexNS
@@ -0,0 +1,60 @@
+/**
+ *  MIT License
+ *
+ *  Copyright (c) Dmitry Makarenko 2019
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#ifndef INTELHEX_CORPUS_H
+#define INTELHEX_CORPUS_H
+
+#include <cstdint>
+#include <ostream>
+
+namespace IntelHexNS {
+
+// Shape of a synthetic Intel HEX file, the same options always give the same bytes
+struct CorpusOptions
+{
+    uint64_t size          = 1 << 20; // payload bytes
+    uint32_t seed          = 1;
+    uint32_t start         = 0;  // address of the first byte
+    uint8_t lineWidth      = 16; // data bytes per record, 1..255
+    uint32_t chunk         = 0;  // contiguous bytes between gaps, 0 - no gaps
+    uint32_t gap           = 0;  // bytes skipped after every chunk
+    uint32_t extendedEvery = 0;  // repeat type 04 before every Nth data record, 0 - on page change only
+    double errorRate       = 0;  // share of data records corrupted
+};
+
+struct CorpusStats
+{
+    uint64_t payload   = 0; // bytes in data records, corrupted ones included
+    uint64_t records   = 0; // all records, end of file included
+    uint64_t extended  = 0; // type 04 records
+    uint64_t corrupted = 0; // data records with an injected error
+};
+
+// Writes the file, corrupted records get a wrong checksum, a non-hex digit,
+// a dropped character or a missing start code
+CorpusStats generateCorpus(const CorpusOptions &options, std::ostream &output);
+
+} // namespace IntelHexNS
+
+#endif // INTELHEX_CORPUS_H
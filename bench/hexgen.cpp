@@ -0,0 +1,123 @@
+/**
+ *  MIT License
+ *
+ *  Copyright (c) Dmitry Makarenko 2019
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+// Usage: hexgen [--size N[K|M|G]] [--seed N] [--start ADDRESS] [--line-width N]
+//               [--chunk N[K|M|G]] [--gap N[K|M|G]] [--extended-every N]
+//               [--error-rate R] [-o file]
+//
+// Writes a deterministic synthetic Intel HEX file to the file or stdout,
+// record counts go to stderr.
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "corpus.h"
+
+using namespace IntelHexNS;
+
+namespace {
+
+uint64_t parseSize(const std::string &text)
+{
+    size_t end;
+    uint64_t value = std::stoull(text, &end, 0);
+    switch (end < text.size() ? toupper(text[end]) : 0) {
+    case 'G':
+        return value << 30;
+    case 'M':
+        return value << 20;
+    case 'K':
+        return value << 10;
+    default:
+        return value;
+    }
+}
+
+bool parseOptions(int argc, char **argv, CorpusOptions &options, std::string &path)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        std::string value = argv[++i];
+        if (arg == "--size")
+            options.size = parseSize(value);
+        else if (arg == "--seed")
+            options.seed = uint32_t(std::stoul(value, nullptr, 0));
+        else if (arg == "--start")
+            options.start = uint32_t(std::stoul(value, nullptr, 0));
+        else if (arg == "--line-width")
+            options.lineWidth = uint8_t(std::min(255ul, std::max(1ul, std::stoul(value))));
+        else if (arg == "--chunk")
+            options.chunk = uint32_t(parseSize(value));
+        else if (arg == "--gap")
+            options.gap = uint32_t(parseSize(value));
+        else if (arg == "--extended-every")
+            options.extendedEvery = uint32_t(std::stoul(value));
+        else if (arg == "--error-rate")
+            options.errorRate = std::stod(value);
+        else if (arg == "-o")
+            path = value;
+        else
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    CorpusOptions options;
+    std::string path;
+    try {
+        if (!parseOptions(argc, argv, options, path))
+            throw std::invalid_argument("unknown option");
+    }
+    catch (const std::exception &) {
+        std::cerr << "usage: hexgen [--size N[K|M|G]] [--seed N] [--start ADDRESS] [--line-width N]\n"
+                     "              [--chunk N[K|M|G]] [--gap N[K|M|G]] [--extended-every N]\n"
+                     "              [--error-rate R] [-o file]"
+                  << std::endl;
+        return 1;
+    }
+
+    std::ofstream file;
+    if (!path.empty()) {
+        file.open(path, std::ios::binary);
+        if (!file) {
+            std::cerr << "cannot open " << path << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &output = path.empty() ? std::cout : file;
+
+    CorpusStats stats = generateCorpus(options, output);
+    std::cerr << stats.payload << " payload bytes, " << stats.records << " records, " << stats.extended
+              << " extended address, " << stats.corrupted << " corrupted" << std::endl;
+    return output.good() ? 0 : 1;
+}
@@ -0,0 +1,61 @@
+/**
+ *  MIT License
+ *
+ *  Copyright (c) Dmitry Makarenko 2019
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+// libFuzzer target for loads(), build with -DINTELHEX_FUZZ=ON using clang
+// and run as: fuzz_loads fuzz/corpus
+//
+// The same input goes through auto-detection and every text and binary
+// parser, once with the default strict settings and once lenient.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "intelhex.h"
+
+using namespace IntelHexNS;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static const IntelHex::Format formats[] = {
+        IntelHex::Format::AUTO, IntelHex::Format::INTEL_HEX, IntelHex::Format::SREC,
+        IntelHex::Format::TI_TXT, IntelHex::Format::ELF, IntelHex::Format::UF2,
+        IntelHex::Format::NATIVE,
+    };
+    std::string input(reinterpret_cast<const char *>(data), size);
+
+    for (auto format : formats) {
+        for (bool lenient : {false, true}) {
+            IntelHex hex;
+            hex.setStrict(!lenient);
+            hex.setLenient(lenient);
+            if (hex.loads(input, format) != IntelHex::Result::SUCCESS)
+                continue;
+            // walking whatever was built catches broken blocks
+            volatile uint8_t byte = hex.get(hex.minAddress());
+            byte = hex.get(hex.maxAddress());
+            (void)byte;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+/**
+ *  MIT License
+ *
+ *  Copyright (c) Dmitry Makarenko 2019
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+// Usage: fuzz_replay [--runs N] file|directory...
+//
+// Feeds saved inputs to the fuzz target without libFuzzer, so crashes and
+// the seed corpus can be replayed with any compiler. Reports executions per
+// second over all runs to show the cost of parser changes.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "std_compat.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+namespace {
+
+void collect(const fs::path &path, std::vector<std::string> &inputs)
+{
+    if (fs::is_directory(path)) {
+        for (const auto &entry : fs::directory_iterator(path))
+            collect(entry.path(), inputs);
+        return;
+    }
+    std::ifstream file(path, std::ios::binary);
+    if (file)
+        inputs.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    unsigned runs = 1;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--runs" && i + 1 < argc)
+            runs = std::max(1ul, std::stoul(argv[++i]));
+        else
+            collect(arg, inputs);
+    }
+    if (inputs.empty()) {
+        std::cerr << "usage: fuzz_replay [--runs N] file|directory..." << std::endl;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned run = 0; run < runs; run++) {
+        for (const auto &input : inputs)
+            LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t *>(input.data()), input.size());
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    uint64_t executions = uint64_t(runs) * inputs.size();
+    std::cout << executions << " executions in " << elapsed.count() << " s, "
+              << uint64_t(executions / std::max(elapsed.count(), 1e-9)) << " exec/s" << std::endl;
+    return 0;
+}
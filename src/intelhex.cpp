@@ -23,15 +23,52 @@
  */
 
 #include "intelhex.h"
+#include "intelhex_decode.h"
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <ctype.h>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string.h>
+#include <thread>
 #include <vector>
 
+// native images and sidecar caches are mapped where mmap is available
+#if defined(__unix__) || defined(__APPLE__)
+#define INTELHEX_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <process.h>
+#endif
+
 using namespace IntelHexNS;
+using namespace IntelHexNS::Hex;
+
+// Statistics cost a clock read per phase and record, so they are built in only on request
+#ifdef INTELHEX_STATS
+#define INTELHEX_STAT(statement) statement
+
+using StatClock = std::chrono::steady_clock;
+
+// block buffer growths on this thread, loads and saves report the difference
+static thread_local uint64_t s_reallocations = 0;
+
+// adds the time since start to total and starts the next phase
+static void lap(std::chrono::nanoseconds &total, StatClock::time_point &start)
+{
+    auto now = StatClock::now();
+    total += now - start;
+    start = now;
+}
+#else
+#define INTELHEX_STAT(statement)
+#endif
 
 enum class RecordType
 {
@@ -45,18 +82,6 @@ enum class RecordType
 
 static const char IHEX_EOF[] = ":00000001FF\n";
 
-uint8_t from_hex(char c)
-{
-    if (c >= '0' && c <= '9')
-        return c - '0';
-    else if (c >= 'A' && c <= 'F')
-        return c - 'A' + 10;
-    else if (c >= 'a' && c <= 'f')
-        return c - 'a' + 10;
-    else
-        return 0;
-}
-
 template<typename T>
 static T from_hex(const char *str)
 {
@@ -73,7 +98,7 @@ static T from_hex(const char *str)
     else if (std::is_same_v<uint32_t, T>) {
         T res(0);
         res = from_hex<uint16_t>(str) << 16;
-        str += 2;
+        str += 4;
         res |= from_hex<uint16_t>(str);
         return res;
     }
@@ -87,15 +112,80 @@ void to_hex(uint8_t byte, char *out)
     out[1]     = hex[byte & 0x0F];
 }
 
-bool isChecksumCorrect(string_view view)
+// Only used to locate the offending char once a record failed validation
+static const char *findNonHex(const char *begin, const char *end)
 {
-    uint8_t cs = 0;
-    for (const char *ptr = view.data() + 1; ptr < view.data() + view.size() - 1; ptr += 2) {
-        cs += from_hex<uint8_t>(ptr);
+    return std::find_if(begin, end, [](char c) { return !isHexDigit(c); });
+}
+
+// Length of the line without trailing whitespace such as \r
+static size_t trimmedSize(string_view view)
+{
+    size_t size = view.size();
+    while (size > 0 && isspace(static_cast<unsigned char>(view[size - 1]))) {
+        size--;
     }
-    return cs == 0;
+    return size;
 }
 
+// View of a whole file, mapped where the platform allows it. A writable view is
+// a private mapping, pages written through it are copied and never reach the file
+class IntelHexNS::MappedFile {
+public:
+    explicit MappedFile(const fs::path &path, bool writable = false)
+    {
+#ifdef INTELHEX_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat info;
+        if (fstat(fd, &info) == 0) {
+            m_size = info.st_size;
+            m_open = true;
+            if (m_size > 0) {
+                int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+                void *mapping  = mmap(nullptr, m_size, protection, MAP_PRIVATE, fd, 0);
+                if (mapping != MAP_FAILED)
+                    m_data = static_cast<uint8_t *>(mapping);
+                else
+                    m_open = false;
+            }
+        }
+        ::close(fd);
+#else
+        (void)writable;
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return;
+        m_buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+        m_open = true;
+#endif
+    }
+    ~MappedFile()
+    {
+#ifdef INTELHEX_MMAP
+        if (m_data)
+            munmap(m_data, m_size);
+#endif
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool isOpen() const { return m_open; }
+    uint8_t *data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    uint8_t *m_data = nullptr;
+    size_t m_size   = 0;
+    bool m_open     = false;
+#ifndef INTELHEX_MMAP
+    std::vector<uint8_t> m_buffer;
+#endif
+};
+
 struct IntelHexNS::Block {
 public:
     Block()
@@ -107,31 +197,42 @@ public:
         , m_valid(true)
     {
     }
+    // copies of mapped blocks go to the heap, writes to one must not show in the other
     Block(const Block &other)
         : m_base_address(other.m_base_address)
         , m_extended_address(other.m_extended_address)
         , m_length(other.m_length)
         , m_valid(true)
     {
-        m_data = (uint8_t *) malloc(other.m_allocated_length);
-        memcpy(m_data, other.m_data, m_length);
-        m_allocated_length = other.m_allocated_length;
+        m_allocated_length = other.m_mapping ? other.m_length : other.m_allocated_length;
+        m_data             = (uint8_t *) malloc(m_allocated_length);
+        if (m_length)
+            memcpy(m_data, other.m_data, m_length);
     }
-    ~Block() { free(m_data); }
-    void add_bytes(uint8_t *data, uint16_t length)
+    ~Block() { release(); }
+    void add_bytes(const uint8_t *data, uint32_t length)
     {
+        if (length == 0)
+            return;
+        unmap();
         if (m_length + length > m_allocated_length) {
             m_allocated_length += length * 2;
             uint8_t *reallocated_data = (uint8_t *) realloc(m_data, m_allocated_length);
             if (reallocated_data == nullptr)
                 return;
             m_data = reallocated_data;
+            INTELHEX_STAT(s_reallocations++);
         }
         memcpy(&m_data[m_length], data, length);
         m_length += length;
     }
     void set_base_address(uint16_t address) { m_base_address = address; }
     void set_extended_address(uint16_t address) { m_extended_address = address; }
+    void set_address(uint32_t address)
+    {
+        set_base_address(address & 0xFFFF);
+        set_extended_address(address >> 16);
+    }
 
     uint32_t address() const { return (m_extended_address << 16) + m_base_address; }
 
@@ -139,6 +240,54 @@ public:
 
     uint8_t *data() const { return m_data; }
 
+    // Sets the length without initialising new bytes, so data can be read in place
+    uint8_t *resize(uint32_t length)
+    {
+        unmap();
+        if (length > m_allocated_length) {
+            uint8_t *reallocated_data = (uint8_t *) realloc(m_data, length);
+            if (reallocated_data == nullptr)
+                return nullptr;
+            m_data             = reallocated_data;
+            m_allocated_length = length;
+            INTELHEX_STAT(s_reallocations++);
+        }
+        m_length = length;
+        return m_data;
+    }
+
+    uint32_t allocated() const { return m_allocated_length; }
+
+    // Points the block at data inside a mapped file, which stays open as long as the block uses it
+    void map(const std::shared_ptr<MappedFile> &mapping, uint8_t *data, uint32_t length)
+    {
+        release();
+        m_mapping          = mapping;
+        m_data             = data;
+        m_length           = length;
+        m_allocated_length = 0;
+    }
+
+    bool mapped() const { return m_mapping != nullptr; }
+
+    // Gives the slack left by add_bytes growth back to the allocator
+    void shrink_to_fit()
+    {
+        if (m_mapping || m_allocated_length == m_length)
+            return;
+        if (m_length == 0) {
+            free(m_data);
+            m_data = nullptr;
+        }
+        else {
+            uint8_t *reallocated_data = (uint8_t *) realloc(m_data, m_length);
+            if (reallocated_data == nullptr)
+                return;
+            m_data = reallocated_data;
+        }
+        m_allocated_length = m_length;
+    }
+
     void set_valid_flag(bool val) { m_valid = val; }
     bool is_valid() const { return m_valid; }
 
@@ -149,12 +298,12 @@ public:
             uint32_t newAddress = eaddress + elength;
             uint8_t *data       = (uint8_t *) malloc(newLength);
             memcpy(data, &m_data[m_length - newLength], newLength);
-            free(m_data);
-            m_data   = data;
-            m_length = newLength;
+            release();
+            m_data             = data;
+            m_length           = newLength;
+            m_allocated_length = newLength;
 
-            set_base_address(newAddress & 0xFFFF);
-            set_extended_address(newAddress >> 16);
+            set_address(newAddress);
         }
         else {
             m_length = eaddress - address();
@@ -162,12 +311,35 @@ public:
     }
 
 private:
+    // moves mapped data to the heap before the buffer is reallocated
+    void unmap()
+    {
+        if (!m_mapping)
+            return;
+        uint8_t *data = (uint8_t *) malloc(m_length);
+        if (m_length)
+            memcpy(data, m_data, m_length);
+        m_mapping.reset();
+        m_data             = data;
+        m_allocated_length = m_length;
+    }
+
+    void release()
+    {
+        if (m_mapping)
+            m_mapping.reset();
+        else
+            free(m_data);
+        m_data = nullptr;
+    }
+
     uint8_t *m_data;
     uint32_t m_length;
     uint32_t m_allocated_length;
     uint16_t m_base_address;
     uint16_t m_extended_address;
     bool m_valid;
+    std::shared_ptr<MappedFile> m_mapping; // set while m_data points into a mapped file
 };
 
 IntelHex::IntelHex()
@@ -184,7 +356,21 @@ IntelHex::IntelHex(fs::path path)
 }
 
 IntelHex::IntelHex(const IntelHex &hex)
-    : filename(hex.filename)
+    : m_state(hex.m_state)
+    , filename(hex.filename)
+    , m_fillChar(hex.m_fillChar)
+    , m_lineWidth(hex.m_lineWidth)
+    , m_strict(hex.m_strict)
+    , m_lenient(hex.m_lenient)
+    , m_damaged(hex.m_damaged)
+    , m_cacheDirectory(hex.m_cacheDirectory)
+    , m_loadedFromCache(hex.m_loadedFromCache)
+    , m_uf2FamilyId(hex.m_uf2FamilyId)
+    , m_hasStartSegment(hex.m_hasStartSegment)
+    , m_startCS(hex.m_startCS)
+    , m_startIP(hex.m_startIP)
+    , m_hasStartLinear(hex.m_hasStartLinear)
+    , m_startEIP(hex.m_startEIP)
 {
     // deep copying all blocks
     for (const auto block : hex.m_blocks) {
@@ -197,9 +383,22 @@ IntelHex::IntelHex(IntelHex &&hex)
     , m_state(hex.m_state)
     , filename(hex.filename)
     , m_fillChar(hex.m_fillChar)
+    , m_lineWidth(hex.m_lineWidth)
+    , m_strict(hex.m_strict)
+    , m_lenient(hex.m_lenient)
+    , m_damaged(hex.m_damaged)
+    , m_cacheDirectory(hex.m_cacheDirectory)
+    , m_loadedFromCache(hex.m_loadedFromCache)
+    , m_uf2FamilyId(hex.m_uf2FamilyId)
+    , m_hasStartSegment(hex.m_hasStartSegment)
+    , m_startCS(hex.m_startCS)
+    , m_startIP(hex.m_startIP)
+    , m_hasStartLinear(hex.m_hasStartLinear)
+    , m_startEIP(hex.m_startEIP)
 {
     // blocks are no longer owned by hex
     hex.m_blocks.clear();
+    hex.m_cachedBlock = nullptr;
 }
 
 IntelHex::~IntelHex()
@@ -220,9 +419,22 @@ IntelHex &IntelHex::operator=(const IntelHex &hex)
     for (const auto block : hex.m_blocks) {
         m_blocks.push_back(new Block(*block));
     }
-    filename   = hex.filename;
-    m_fillChar = hex.m_fillChar;
-    m_state    = hex.m_state;
+    filename          = hex.filename;
+    m_fillChar        = hex.m_fillChar;
+    m_lineWidth       = hex.m_lineWidth;
+    m_strict          = hex.m_strict;
+    m_lenient         = hex.m_lenient;
+    m_damaged         = hex.m_damaged;
+    m_cacheDirectory  = hex.m_cacheDirectory;
+    m_loadedFromCache = hex.m_loadedFromCache;
+    m_uf2FamilyId     = hex.m_uf2FamilyId;
+    m_state           = hex.m_state;
+    m_hasStartSegment = hex.m_hasStartSegment;
+    m_startCS         = hex.m_startCS;
+    m_startIP         = hex.m_startIP;
+    m_hasStartLinear  = hex.m_hasStartLinear;
+    m_startEIP        = hex.m_startEIP;
+    m_cachedBlock     = nullptr;
     return *this;
 }
 
@@ -235,22 +447,337 @@ IntelHex &IntelHex::operator=(IntelHex &&hex)
         delete block;
     }
 
-    filename   = hex.filename;
-    m_fillChar = hex.m_fillChar;
-    m_state    = hex.m_state;
-    m_blocks   = hex.m_blocks;
+    filename          = hex.filename;
+    m_fillChar        = hex.m_fillChar;
+    m_lineWidth       = hex.m_lineWidth;
+    m_strict          = hex.m_strict;
+    m_lenient         = hex.m_lenient;
+    m_damaged         = hex.m_damaged;
+    m_cacheDirectory  = hex.m_cacheDirectory;
+    m_loadedFromCache = hex.m_loadedFromCache;
+    m_uf2FamilyId     = hex.m_uf2FamilyId;
+    m_state           = hex.m_state;
+    m_hasStartSegment = hex.m_hasStartSegment;
+    m_startCS         = hex.m_startCS;
+    m_startIP         = hex.m_startIP;
+    m_hasStartLinear  = hex.m_hasStartLinear;
+    m_startEIP        = hex.m_startEIP;
+    m_blocks          = hex.m_blocks;
+    m_cachedBlock     = hex.m_cachedBlock;
 
     // blocks are no longer owned by hex
     hex.m_blocks.clear();
+    hex.m_cachedBlock = nullptr;
 
     return *this;
 }
 
-IntelHex::Result IntelHex::parse(std::istream &input)
+// Appends a data record, starting a new block when it is not contiguous with the current one
+static void appendRecord(std::vector<Block *> &blocks,
+                         Block *&currentBlock,
+                         uint32_t address,
+                         const uint8_t *data,
+                         uint32_t length)
+{
+    if (currentBlock->address() + currentBlock->length() != address) {
+        if (currentBlock->length() > 0) {
+            blocks.push_back(currentBlock);
+            currentBlock = new Block();
+        }
+        currentBlock->set_address(address);
+    }
+    currentBlock->add_bytes(data, length);
+}
+
+#ifdef INTELHEX_STATS
+// Resets the stats of a load or save and fills in the totals when it is done
+class StatsScope {
+public:
+    StatsScope(IntelHex::Stats &stats, const std::vector<Block *> &blocks)
+        : m_stats(stats)
+        , m_blocks(blocks)
+        , m_reallocations(s_reallocations)
+        , m_start(StatClock::now())
+    {
+        m_stats = IntelHex::Stats();
+    }
+    ~StatsScope()
+    {
+        m_stats.total         = StatClock::now() - m_start;
+        m_stats.blocks        = m_blocks.size();
+        m_stats.reallocations = s_reallocations - m_reallocations;
+    }
+
+private:
+    IntelHex::Stats &m_stats;
+    const std::vector<Block *> &m_blocks;
+    uint64_t m_reallocations;
+    StatClock::time_point m_start;
+};
+#endif
+
+// Looks at the first bytes without consuming them, the stream is rewound
+// to where it was, so the input is still read only once
+IntelHex::Format IntelHex::detectFormat(std::istream &input)
+{
+    std::array<char, 64> head;
+    auto start = input.tellg();
+    input.read(head.data(), head.size());
+    size_t size = input.gcount();
+    input.clear();
+    input.seekg(start);
+
+    if (size >= 4 && memcmp(head.data(), "\x7F" "ELF", 4) == 0)
+        return Format::ELF;
+    if (size >= 8 && memcmp(head.data(), "UF2\nWQ]\x9E", 8) == 0)
+        return Format::UF2;
+    if (size >= 4 && memcmp(head.data(), "IHXN", 4) == 0)
+        return Format::NATIVE;
+
+    size_t pos = 0;
+    while (pos < size && (head[pos] == ' ' || head[pos] == '\t' || head[pos] == '\r' || head[pos] == '\n')) {
+        pos++;
+    }
+    // empty input is left to the Intel HEX parser
+    if (pos == size)
+        return Format::INTEL_HEX;
+    if (pos + 1 < size && head[pos] == ':' && isHexDigit(head[pos + 1]))
+        return Format::INTEL_HEX;
+    if (pos + 2 < size && head[pos] == 'S' && head[pos + 1] >= '0' && head[pos + 1] <= '9' &&
+        isHexDigit(head[pos + 2]))
+        return Format::SREC;
+    if (pos + 1 < size && head[pos] == '@' && isHexDigit(head[pos + 1]))
+        return Format::TI_TXT;
+    // text that is none of the above is most likely a damaged hex file,
+    // the Intel HEX parser reports where it goes wrong or recovers in lenient mode
+    for (size_t i = 0; i < size; i++) {
+        auto c = static_cast<unsigned char>(head[i]);
+        if ((c < 0x20 || c > 0x7E) && c != '\t' && c != '\r' && c != '\n')
+            return Format::BINARY;
+    }
+    return Format::INTEL_HEX;
+}
+
+void IntelHex::fail(ParseError error, const LineCursor &cursor, uint32_t column, int recordType)
+{
+    m_diagnostics.error      = error;
+    m_diagnostics.line       = cursor.number;
+    m_diagnostics.column     = column;
+    m_diagnostics.offset     = cursor.offset;
+    m_diagnostics.recordType = recordType;
+    m_state                  = Result::INCORRECT_FILE;
+}
+
+IntelHex::Result IntelHex::state() const
+{
+    return m_state;
+}
+
+bool IntelHex::skipDamaged(ParseError error,
+                           const LineCursor &cursor,
+                           uint32_t column,
+                           int recordType,
+                           Range damaged)
+{
+    if (!m_lenient) {
+        fail(error, cursor, column, recordType);
+        return false;
+    }
+    // diagnostics keep the first problem found
+    if (m_diagnostics.error == ParseError::NONE) {
+        fail(error, cursor, column, recordType);
+        m_state = Result::UNKNOWN;
+    }
+    if (damaged.length > 0) {
+        if (!m_damaged.empty() &&
+            uint64_t(m_damaged.back().address) + m_damaged.back().length == damaged.address) {
+            m_damaged.back().length += damaged.length;
+        }
+        else {
+            m_damaged.push_back(damaged);
+        }
+    }
+    return true;
+}
+
+const std::vector<IntelHex::Range> &IntelHex::damagedRanges() const
+{
+    return m_damaged;
+}
+
+void IntelHex::setLenient(bool lenient)
+{
+    m_lenient = lenient;
+}
+
+const IntelHex::Stats &IntelHex::stats() const
+{
+    return m_stats;
+}
+
+const IntelHex::Diagnostics &IntelHex::diagnostics() const
+{
+    return m_diagnostics;
+}
+
+IntelHex::Result IntelHex::parse(std::istream &input, Format format)
+{
+    m_diagnostics = Diagnostics();
+    m_damaged.clear();
+    // start addresses come from this input only, loads() keeps the blocks but not these
+    m_hasStartSegment = false;
+    m_hasStartLinear  = false;
+    INTELHEX_STAT(StatsScope scope(m_stats, m_blocks));
+    if (format == Format::AUTO)
+        format = detectFormat(input);
+
+    switch (format) {
+    case Format::INTEL_HEX:
+        return parseIntelHex(input);
+    case Format::SREC:
+        return parseSrec(input);
+    case Format::TI_TXT:
+        return parseTiTxt(input);
+    case Format::ELF:
+        return parseElf(input);
+    case Format::UF2:
+        return parseUf2(input);
+    case Format::BINARY:
+        return parseBinary(input);
+    case Format::NATIVE:
+        return parseNative(input);
+    default:
+        break;
+    }
+    m_state = Result::UNSUPPORTED_FORMAT;
+    return m_state;
+}
+
+// Reads size bytes at offset of an ELF structure in the file's byte order
+static uint64_t elfField(const uint8_t *data, size_t offset, size_t size, bool bigEndian)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        size_t index = bigEndian ? offset + i : offset + size - 1 - i;
+        value        = (value << 8) | data[index];
+    }
+    return value;
+}
+
+IntelHex::Result IntelHex::parseElf(std::istream &input)
+{
+    enum
+    {
+        ELFCLASS32  = 1,
+        ELFCLASS64  = 2,
+        ELFDATA2LSB = 1,
+        ELFDATA2MSB = 2,
+        PT_LOAD     = 1,
+    };
+
+    auto start = input.tellg();
+    input.seekg(0, std::ios::end);
+    uint64_t fileSize = input.tellg() - start;
+    input.seekg(start);
+
+    std::array<uint8_t, 64> header;
+    if (fileSize < header.size() || !input.read(reinterpret_cast<char *>(header.data()), header.size()) ||
+        memcmp(header.data(), "\x7F" "ELF", 4) != 0) {
+        m_state = Result::INCORRECT_FILE;
+        return m_state;
+    }
+    bool is64      = header[4] == ELFCLASS64;
+    bool bigEndian = header[5] == ELFDATA2MSB;
+    if ((header[4] != ELFCLASS32 && !is64) || (header[5] != ELFDATA2LSB && !bigEndian)) {
+        m_state = Result::UNSUPPORTED_FORMAT;
+        return m_state;
+    }
+
+    // e_phoff, e_phentsize and e_phnum; program header p_offset, p_paddr and p_filesz
+    uint64_t phoff     = is64 ? elfField(header.data(), 0x20, 8, bigEndian)
+                              : elfField(header.data(), 0x1C, 4, bigEndian);
+    uint64_t phentsize = elfField(header.data(), is64 ? 0x36 : 0x2A, 2, bigEndian);
+    uint64_t phnum     = elfField(header.data(), is64 ? 0x38 : 0x2C, 2, bigEndian);
+    size_t minEntry    = is64 ? 0x38 : 0x20;
+    if (phentsize < minEntry || phoff > fileSize || phnum * phentsize > fileSize - phoff) {
+        m_state = Result::INCORRECT_FILE;
+        return m_state;
+    }
+
+    std::vector<uint8_t> table(phnum * phentsize);
+    input.seekg(start + std::streamoff(phoff));
+    if (!input.read(reinterpret_cast<char *>(table.data()), table.size())) {
+        m_state = Result::INCORRECT_FILE;
+        return m_state;
+    }
+
+    for (uint64_t i = 0; i < phnum; i++) {
+        const uint8_t *entry = &table[i * phentsize];
+        if (elfField(entry, 0, 4, bigEndian) != PT_LOAD)
+            continue;
+        uint64_t offset = is64 ? elfField(entry, 0x08, 8, bigEndian) : elfField(entry, 0x04, 4, bigEndian);
+        uint64_t paddr  = is64 ? elfField(entry, 0x18, 8, bigEndian) : elfField(entry, 0x0C, 4, bigEndian);
+        uint64_t filesz = is64 ? elfField(entry, 0x20, 8, bigEndian) : elfField(entry, 0x10, 4, bigEndian);
+
+        // memory-only part of the segment (.bss) is not in the image, as with objcopy
+        if (filesz == 0)
+            continue;
+        if (offset > fileSize || filesz > fileSize - offset) {
+            m_state = Result::INCORRECT_FILE;
+            return m_state;
+        }
+        // written so that a 64 bit paddr near the top can't wrap the sum
+        if (paddr > 0xFFFFFFFF || filesz > 0x100000000ULL - paddr) {
+            m_state = Result::UNSUPPORTED_FORMAT;
+            return m_state;
+        }
+
+        // segment is read straight into the block storage
+        Block *block = new Block();
+        block->set_address(paddr);
+        uint8_t *data = block->resize(filesz);
+        input.seekg(start + std::streamoff(offset));
+        if (data == nullptr || !input.read(reinterpret_cast<char *>(data), filesz)) {
+            delete block;
+            m_state = Result::INCORRECT_FILE;
+            return m_state;
+        }
+        m_blocks.push_back(block);
+    }
+    m_state = Result::SUCCESS;
+    return m_state;
+}
+
+IntelHex::Result IntelHex::parseBinary(std::istream &input)
+{
+    auto start = input.tellg();
+    input.seekg(0, std::ios::end);
+    uint64_t length = input.tellg() - start;
+    input.seekg(start);
+    if (length > 0xFFFFFFFF) {
+        m_state = Result::UNSUPPORTED_FORMAT;
+        return m_state;
+    }
+
+    Block *block  = new Block();
+    uint8_t *data = block->resize(length);
+    if (length > 0 && (data == nullptr || !input.read(reinterpret_cast<char *>(data), length))) {
+        delete block;
+        m_state = Result::INCORRECT_FILE;
+        return m_state;
+    }
+    m_blocks.push_back(block);
+    m_state = Result::SUCCESS;
+    return m_state;
+}
+
+IntelHex::Result IntelHex::parseIntelHex(std::istream &input)
 {
     std::string line;
-    uint16_t extended_address(0);
+    // upper address bits from the last type 04 (linear) or type 02 (segment) record
+    uint32_t base_address(0);
     Block *currentBlock = new Block();
+    LineCursor cursor;
 
     while (std::getline(input, line) && m_state == Result::UNKNOWN) {
         RecordType type;
@@ -258,205 +785,700 @@ IntelHex::Result IntelHex::parse(std::istream &input)
         uint16_t address(0);
         uint8_t buf[256];
 
-        if (line.size() < 11)
+        cursor.advance(line.size());
+        INTELHEX_STAT(auto phase = StatClock::now());
+        if (line.size() < 11) {
+            if (m_strict && trimmedSize(line) > 0 && !skipDamaged(ParseError::LENGTH_MISMATCH, cursor, 1))
+                break;
             continue;
+        }
 
         if (line[0] != ':') {
-            delete currentBlock;
-            m_state = Result::INCORRECT_FILE;
+            if (skipDamaged(ParseError::BAD_START_CODE, cursor, 1))
+                continue;
             break;
         }
 
+        INTELHEX_STAT(m_stats.records++);
         string_view view(line);
         const char *data = view.data() + 1;
 
-        length = from_hex<uint8_t>(data);
-        data += 2;
-
-        address = from_hex<uint16_t>(data);
-        data += 4;
+        // every pair is decoded once, summing the checksum and
+        // collecting invalid chars on the way
+        uint8_t invalid = 0;
+        uint8_t sum     = 0;
+
+        RecordHeader header = decodeHeader(data, invalid);
+        length              = header.length;
+        address             = header.address;
+        uint8_t type_byte   = header.type;
+        type                = static_cast<RecordType>(type_byte);
+        data += 8;
+
+        // bytes a damaged data record was meant to hold, as far as its header can be trusted
+        Range damaged = {base_address + address, type == RecordType::Data ? length : 0u};
+
+        // data and checksum must be on the line, in strict mode nothing else may be
+        size_t size = m_strict ? trimmedSize(view) : view.size();
+        if (size < 11 + length * 2u || (m_strict && size != 11 + length * 2u)) {
+            if (skipDamaged(ParseError::LENGTH_MISMATCH, cursor, 2, type_byte, damaged))
+                continue;
+            break;
+        }
 
-        type = static_cast<RecordType>(from_hex<uint8_t>(data));
-        data += 2;
+        sum = header.sum() + decodePayload(data, buf, length, invalid);
+        data += length * 2;
+        sum += decodePair(data, invalid);
+        INTELHEX_STAT(lap(m_stats.decode, phase));
 
-        for (int i = 0; i < length; i++) {
-            buf[i] = from_hex<uint8_t>(data);
-            data += 2;
+        if (m_strict && (invalid & HEX_INVALID)) {
+            const char *bad = findNonHex(view.data() + 1, view.data() + size);
+            if (skipDamaged(ParseError::BAD_HEX_DIGIT, cursor, bad - view.data() + 1, type_byte, damaged))
+                continue;
+            break;
         }
 
-        if (!isChecksumCorrect(view)) {
-            delete currentBlock;
-            m_state = Result::INCORRECT_FILE;
+        if (sum != 0) {
+            if (skipDamaged(ParseError::BAD_CHECKSUM, cursor, 10 + length * 2, type_byte, damaged))
+                continue;
             break;
         }
+        INTELHEX_STAT(lap(m_stats.checksum, phase));
 
         switch (type) {
         case RecordType::Data:
-            if (currentBlock->address() + currentBlock->length() !=
-                    (uint32_t)((extended_address << 16) + address) ||
-                (currentBlock->address() >> 16) != extended_address) {
-                if (currentBlock->length() > 0) {
-                    m_blocks.push_back(currentBlock);
-                    currentBlock = new Block();
-                }
-                currentBlock->set_extended_address(extended_address);
-                currentBlock->set_base_address(address);
-            }
-            currentBlock->add_bytes(buf, length);
+            appendRecord(m_blocks, currentBlock, base_address + address, buf, length);
             break;
         case RecordType::EndOfFile:
             m_blocks.push_back(currentBlock);
             m_state = Result::SUCCESS;
             break;
         case RecordType::StartLinearAddress:
+            // EIP 4 bytes, big endian
+            if (length == 4) {
+                m_hasStartLinear = true;
+                m_startEIP       = (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+            }
+            else {
+                skipDamaged(ParseError::BAD_RECORD, cursor, 2, int(type));
+            }
             break;
         case RecordType::ExtendedLinearAddress:
             // extended address 2 bytes, always big endian
             if (length == 2) {
-                extended_address = (buf[0] << 8) | buf[1];
+                base_address = ((buf[0] << 8) | buf[1]) << 16;
             }
             else {
-                m_state = Result::INCORRECT_FILE;
+                skipDamaged(ParseError::BAD_RECORD, cursor, 2, int(type));
             }
             break;
         case RecordType::ExtendedSegmentAddress:
+            // segment base 2 bytes, big endian, address is segment * 16 + offset
+            if (length == 2) {
+                base_address = ((buf[0] << 8) | buf[1]) << 4;
+            }
+            else {
+                skipDamaged(ParseError::BAD_RECORD, cursor, 2, int(type));
+            }
+            break;
         case RecordType::StartSegmentAddress:
-            m_state = Result::UNSUPPORTED_FORMAT;
+            // CS and IP 2 bytes each, big endian
+            if (length == 4) {
+                m_hasStartSegment = true;
+                m_startCS         = (buf[0] << 8) | buf[1];
+                m_startIP         = (buf[2] << 8) | buf[3];
+            }
+            else {
+                skipDamaged(ParseError::BAD_RECORD, cursor, 2, int(type));
+            }
             break;
         default:
-            m_state = Result::INCORRECT_FILE;
+            skipDamaged(ParseError::BAD_RECORD_TYPE, cursor, 8, int(type));
             break;
         }
+        INTELHEX_STAT(lap(m_stats.building, phase));
     }
-    return m_state;
-}
-
-void IntelHex::setLineWidth(const uint8_t &lineWidth)
-{
-    m_lineWidth = lineWidth;
-}
 
-IntelHex::Result IntelHex::load(fs::path path)
-{
-    std::ifstream infile(path);
-    m_state = Result::UNKNOWN;
-
-    m_blocks.clear();
-    if (!infile.is_open()) {
-        m_state = Result::FILE_NOT_FOUND;
-    }
-    else {
-        m_state = parse(infile);
+    if (m_state == Result::UNKNOWN && skipDamaged(ParseError::MISSING_END, cursor, 0)) {
+        // keeping whatever was recovered
+        m_blocks.push_back(currentBlock);
+        m_state = Result::SUCCESS;
     }
-
-    return m_state;
-}
-
-IntelHex::Result IntelHex::loads(const std::string &hex)
-{
-    m_state = Result::UNKNOWN;
-    std::istringstream input(hex);
-    return parse(input);
-}
-
-IntelHex::Result IntelHex::save()
-{
-    m_state = save(filename);
+    if (m_state != Result::SUCCESS)
+        delete currentBlock;
     return m_state;
 }
 
-uint8_t checksum(uint32_t size, const std::array<uint8_t, 256> &buf)
+IntelHex::Result IntelHex::parseSrec(std::istream &input)
 {
-    uint8_t cs = 0;
-    for (uint32_t i = 0; i < size; i++) {
-        cs += buf[i];
-    }
-    cs = (~cs) + 1;
-    return cs;
-}
+    std::string line;
+    Block *currentBlock = new Block();
+    LineCursor cursor;
 
-IntelHex::Result IntelHex::save(const fs::path &path) const
-{
-    std::ofstream outfile(path);
-    m_state = Result::UNKNOWN;
+    while (std::getline(input, line) && m_state == Result::UNKNOWN) {
+        uint8_t buf[256];
 
-    if (!outfile.is_open())
-        m_state = Result::FILE_NOT_FOUND;
-    uint16_t extended_address = 0;
-    std::array<uint8_t, 256> buf;
-    std::array<char, buf.size()> str;
-    str[0]              = ':';
-    uint8_t line_length = 0;
-    for (auto block : m_blocks) {
-        uint16_t new_extended_address = block->address() >> 16;
-
-        if (extended_address != new_extended_address) {
-            extended_address = new_extended_address;
-            //:02'00'00'04'00'01'F9
-            buf[0]      = 2;
-            buf[1]      = 0;
-            buf[2]      = 0;
-            buf[3]      = static_cast<uint8_t>(RecordType::ExtendedLinearAddress);
-            buf[4]      = extended_address >> 8;
-            buf[5]      = extended_address & 0xFF;
-            line_length = 6;
-            buf[6]      = checksum(line_length, buf);
-            line_length = 7;
-
-            for (int i = 0; i < line_length; i++) {
-                to_hex(buf[i], &(str.data()[1 + i * 2]));
-            }
-            str[line_length * 2 + 1] = '\n';
+        cursor.advance(line.size());
+        if (line.size() < 4) {
+            if (m_strict && trimmedSize(line) > 0 && !skipDamaged(ParseError::LENGTH_MISMATCH, cursor, 1))
+                break;
+            continue;
+        }
 
-            outfile.write(str.data(), line_length * 2 + 2);
+        if (line[0] != 'S' || line[1] < '0' || line[1] > '9') {
+            if (skipDamaged(ParseError::BAD_START_CODE, cursor, 1))
+                continue;
+            break;
         }
-        //:20'FFE0'00'02680A6051607047426808604A60116041607047014880687047C0464C360020B0
-        uint32_t write_pos = 0;
-        while (block->length() > write_pos) {
-            // Default line size
-            uint8_t write_size = m_lineWidth;
 
-            // If current block is running out, writing what's left
-            if (block->length() - write_pos < write_size)
-                write_size = (block->length() - write_pos);
+        string_view view(line);
+        const char *data = view.data() + 2;
+        uint8_t type     = line[1] - '0';
 
-            // Record address, 16 bytes,
-            uint16_t write_addr = (block->address() & 0xFFFF) + write_pos;
+        // count covers address, data and checksum
+        uint8_t count = from_hex<uint8_t>(data);
+        data += 2;
 
-            // Line header: REC_SIZE REC_ADDR REC_TYPE
-            buf[0] = write_size;
-            buf[1] = write_addr >> 8;
-            buf[2] = write_addr & 0xFF;
-            buf[3] = static_cast<uint8_t>(RecordType::Data);
+        // S1/S5/S9 - 16 bit, S2/S6/S8 - 24 bit, S3/S7 - 32 bit address
+        static const uint8_t address_size[] = {2, 2, 3, 4, 0, 2, 3, 4, 3, 2};
+        uint8_t address_length = address_size[type];
 
-            // Advancing forward past header
-            line_length = 4;
+        if (address_length == 0) {
+            if (skipDamaged(ParseError::BAD_RECORD_TYPE, cursor, 2, type))
+                continue;
+            break;
+        }
+        size_t size = m_strict ? trimmedSize(view) : view.size();
+        if (count < address_length + 1 || size < 4 + count * 2u || (m_strict && size != 4 + count * 2u)) {
+            if (skipDamaged(ParseError::LENGTH_MISMATCH, cursor, 3, type))
+                continue;
+            break;
+        }
 
-            // Copying just enough data to new buffer
-            memcpy(&buf[line_length], &(block->data()[write_pos]), write_size);
-            line_length += write_size;
+        uint32_t address = 0;
+        for (int i = 0; i < address_length; i++) {
+            address = (address << 8) | from_hex<uint8_t>(data);
+            data += 2;
+        }
+        uint8_t length = count - address_length - 1;
 
-            // Checksum it all over
-            buf[line_length] = checksum(line_length, buf);
-            line_length++;
+        // bytes a damaged data record was meant to hold, as far as its header can be trusted
+        Range damaged = {address, type >= 1 && type <= 3 ? length : 0u};
 
-            // Converting to ascii
-            for (int i = 0; i < line_length; i++) {
-                to_hex(buf[i], &(str.data()[1 + i * 2]));
-            }
+        uint8_t invalid = 0;
+        uint8_t sum     = sumHexBytes(view.data() + 2, view.data() + 4 + count * 2, invalid);
+        if (m_strict && (invalid & HEX_INVALID)) {
+            const char *bad = findNonHex(view.data() + 2, view.data() + size);
+            if (skipDamaged(ParseError::BAD_HEX_DIGIT, cursor, bad - view.data() + 1, type, damaged))
+                continue;
+            break;
+        }
+        if (sum != 0xFF) {
+            if (skipDamaged(ParseError::BAD_CHECKSUM, cursor, 3 + count * 2, type, damaged))
+                continue;
+            break;
+        }
+
+        // S3 data running past the 32 bit address space would wrap around to 0
+        if (type == 3 && uint64_t(address) + length > 0x100000000ULL) {
+            damaged.length = uint32_t(0x100000000ULL - address);
+            if (skipDamaged(ParseError::BAD_RECORD, cursor, 5, type, damaged))
+                continue;
+            break;
+        }
+
+        for (int i = 0; i < length; i++) {
+            buf[i] = from_hex<uint8_t>(data);
+            data += 2;
+        }
+
+        switch (type) {
+        case 1:
+        case 2:
+        case 3:
+            appendRecord(m_blocks, currentBlock, address, buf, length);
+            break;
+        case 7:
+        case 8:
+        case 9:
+            // termination record carries the entry point, 0 is what writers put
+            // there when there is none, saveSrec() included, so it is not taken as one
+            if (address != 0) {
+                m_hasStartLinear = true;
+                m_startEIP       = address;
+            }
+            m_blocks.push_back(currentBlock);
+            currentBlock = nullptr;
+            m_state      = Result::SUCCESS;
+            break;
+        default:
+            // header and record count are not needed to rebuild the image
+            break;
+        }
+    }
+
+    // termination record is optional in the wild
+    if (m_state == Result::UNKNOWN) {
+        m_blocks.push_back(currentBlock);
+        m_state = Result::SUCCESS;
+    }
+    else if (m_state != Result::SUCCESS) {
+        delete currentBlock;
+    }
+    return m_state;
+}
+
+IntelHex::Result IntelHex::parseTiTxt(std::istream &input)
+{
+    std::string line;
+    uint64_t address    = 0; // wide enough to notice data running past 4G
+    Block *currentBlock = new Block();
+    LineCursor cursor;
+
+    while (std::getline(input, line) && m_state == Result::UNKNOWN) {
+        uint8_t buf[256];
+        uint32_t length = 0;
+
+        cursor.advance(line.size());
+        string_view view(line);
+        const char *data = view.data();
+        const char *end  = view.data() + view.size();
+
+        while (data < end && isspace(static_cast<unsigned char>(*data))) {
+            data++;
+        }
+        if (data == end)
+            continue;
+
+        // @ADDR starts a new section, jumps are split into blocks by appendRecord
+        if (*data == '@') {
+            data++;
+            address = 0;
+            int digits = 0;
+            for (; data < end && isHexDigit(*data); data++, digits++) {
+                address = (address << 4) | from_hex(*data);
+            }
+            if (digits == 0 || digits > 8) {
+                fail(ParseError::BAD_RECORD, cursor, data - view.data() + 1);
+            }
+            continue;
+        }
+
+        if (*data == 'q' || *data == 'Q') {
+            m_blocks.push_back(currentBlock);
+            currentBlock = nullptr;
+            m_state      = Result::SUCCESS;
+            break;
+        }
+
+        // data line: hex pairs separated by whitespace
+        while (data < end) {
+            if (isspace(static_cast<unsigned char>(*data))) {
+                data++;
+                continue;
+            }
+            if (length == sizeof(buf)) {
+                fail(ParseError::LENGTH_MISMATCH, cursor, data - view.data() + 1);
+                break;
+            }
+            if (end - data < 2 || !isHexDigit(data[0]) || !isHexDigit(data[1]) ||
+                (end - data > 2 && !isspace(static_cast<unsigned char>(data[2])))) {
+                fail(ParseError::BAD_HEX_DIGIT, cursor, data - view.data() + 1);
+                break;
+            }
+            buf[length++] = from_hex<uint8_t>(data);
+            data += 2;
+        }
+        if (m_state == Result::UNKNOWN && length > 0 && address + length > 0x100000000ULL)
+            fail(ParseError::BAD_RECORD, cursor, 1);
+        if (m_state == Result::UNKNOWN && length > 0) {
+            appendRecord(m_blocks, currentBlock, address, buf, length);
+            address += length;
+        }
+    }
+
+    // file must be terminated by q
+    if (m_state == Result::UNKNOWN)
+        fail(ParseError::MISSING_END, cursor, 0);
+    if (m_state != Result::SUCCESS)
+        delete currentBlock;
+    return m_state;
+}
+
+void IntelHex::setLineWidth(const uint8_t &lineWidth)
+{
+    m_lineWidth = lineWidth;
+}
+
+void IntelHex::clear()
+{
+    for (auto block : m_blocks) {
+        delete block;
+    }
+    m_blocks.clear();
+    m_cachedBlock     = nullptr;
+    m_hasStartSegment = false;
+    m_hasStartLinear  = false;
+}
+
+// Identifies a source file and the settings it was parsed with, see the sidecar cache below
+struct IntelHex::CacheKey
+{
+    fs::path file; // cache file for the source
+    std::string source;
+    uint64_t size  = 0;
+    int64_t mtime  = 0;
+    uint64_t hash  = 0;
+    uint8_t format = 0;
+    bool strict    = true;
+    bool lenient   = false;
+    // UF2 sources without a family ID keep the one set before loading
+    uint32_t uf2FamilyId = 0;
+};
+
+IntelHex::Result IntelHex::load(fs::path path, Format format)
+{
+    // binary mode so raw images survive, text parsers tolerate \r
+    std::ifstream infile(path, std::ios::binary);
+    m_state = Result::UNKNOWN;
+
+    clear();
+    // a cache hit skips parse(), which would otherwise reset these
+    m_diagnostics = Diagnostics();
+    m_damaged.clear();
+    m_stats           = Stats();
+    m_loadedFromCache = false;
+    if (!infile.is_open()) {
+        m_state = Result::FILE_NOT_FOUND;
+        return m_state;
+    }
+
+    if (format == Format::AUTO)
+        format = detectFormat(infile);
+    // native images are used in place, there is nothing left to cache
+    if (format == Format::NATIVE) {
+        m_state = loadNative(path);
+        return m_state;
+    }
+
+    CacheKey key;
+    bool cached = !m_cacheDirectory.empty() && cacheKey(path, format, key);
+    if (cached && readCache(key)) {
+        m_loadedFromCache = true;
+        m_state           = Result::SUCCESS;
+        return m_state;
+    }
+
+    m_state = parse(infile, format);
+    // images rebuilt from damaged files are not cached, their diagnostics would be lost
+    if (cached && m_state == Result::SUCCESS && m_diagnostics.error == ParseError::NONE)
+        writeCache(key);
+    return m_state;
+}
+
+IntelHex::Result IntelHex::loads(const std::string &hex, Format format)
+{
+    m_state = Result::UNKNOWN;
+    std::istringstream input(hex);
+    return parse(input, format);
+}
+
+IntelHex::Result IntelHex::save()
+{
+    m_state = save(filename);
+    return m_state;
+}
+
+// Longest record: 1 length, 4 address, 1 type, 255 data and 1 checksum bytes
+using RecordBuffer = std::array<uint8_t, 262>;
+using RecordString = std::array<char, RecordBuffer().size() * 2 + 3>;
+
+static uint8_t byteSum(uint32_t size, const RecordBuffer &buf)
+{
+    uint8_t cs = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        cs += buf[i];
+    }
+    return cs;
+}
+
+uint8_t checksum(uint32_t size, const RecordBuffer &buf)
+{
+    return (~byteSum(size, buf)) + 1;
+}
+
+// Converts size bytes of buf to ascii after the start code of given length, returns line length
+static uint32_t encodeRecord(const RecordBuffer &buf, uint32_t size, RecordString &str, uint32_t prefix)
+{
+    for (uint32_t i = 0; i < size; i++) {
+        to_hex(buf[i], &(str.data()[prefix + i * 2]));
+    }
+    str[prefix + size * 2] = '\n';
+    return prefix + size * 2 + 1;
+}
+
+IntelHex::Result IntelHex::save(const fs::path &path, Format format) const
+{
+    if (format == Format::BINARY)
+        return saveBinary(path);
+    // checked before the file is opened, so an existing one is left alone
+    switch (format) {
+    case Format::AUTO:
+    case Format::INTEL_HEX:
+    case Format::SREC:
+    case Format::TI_TXT:
+    case Format::UF2:
+    case Format::NATIVE:
+        break;
+    default:
+        m_state = Result::UNSUPPORTED_FORMAT;
+        return m_state;
+    }
+
+    if (format == Format::NATIVE)
+        return saveNative(path);
+
+    auto mode = format == Format::UF2 ? std::ios::out | std::ios::binary : std::ios::out;
+    std::ofstream outfile(path, mode);
+    m_state = Result::UNKNOWN;
+    INTELHEX_STAT(StatsScope scope(m_stats, m_blocks));
+
+    if (!outfile.is_open()) {
+        m_state = Result::FILE_NOT_FOUND;
+        return m_state;
+    }
+    switch (format) {
+    case Format::AUTO:
+    case Format::INTEL_HEX:
+        saveIntelHex(outfile);
+        break;
+    case Format::SREC:
+        saveSrec(outfile);
+        break;
+    case Format::TI_TXT:
+        saveTiTxt(outfile);
+        break;
+    case Format::UF2: {
+        std::vector<uint8_t> uf2;
+        toUf2(uf2);
+        outfile.write(reinterpret_cast<const char *>(uf2.data()), uf2.size());
+        m_state = Result::SUCCESS;
+        break;
+    }
+    default:
+        break;
+    }
+    outfile.close();
+    return m_state;
+}
+
+void IntelHex::saveIntelHex(std::ostream &outfile) const
+{
+    uint16_t extended_address = 0;
+    RecordBuffer buf;
+    RecordString str;
+    str[0]               = ':';
+    uint32_t line_length = 0;
+    for (auto block : m_blocks) {
+        //:20'FFE0'00'02680A6051607047426808604A60116041607047014880687047C0464C360020B0
+        uint32_t write_pos = 0;
+        while (block->length() > write_pos) {
+            // Blocks may span several 64K pages, so the page is checked for every record
+            uint32_t record_address       = block->address() + write_pos;
+            uint16_t new_extended_address = record_address >> 16;
+
+            if (extended_address != new_extended_address) {
+                extended_address = new_extended_address;
+                //:02'00'00'04'00'01'F9
+                buf[0]      = 2;
+                buf[1]      = 0;
+                buf[2]      = 0;
+                buf[3]      = static_cast<uint8_t>(RecordType::ExtendedLinearAddress);
+                buf[4]      = extended_address >> 8;
+                buf[5]      = extended_address & 0xFF;
+                line_length = 6;
+                buf[6]      = checksum(line_length, buf);
+                line_length = 7;
+
+                outfile.write(str.data(), encodeRecord(buf, line_length, str, 1));
+                INTELHEX_STAT(m_stats.records++);
+            }
+            // Default line size
+            uint8_t write_size = m_lineWidth;
+
+            // If current block is running out, writing what's left
+            if (block->length() - write_pos < write_size)
+                write_size = (block->length() - write_pos);
+
+            // Record address, 16 bytes,
+            uint16_t write_addr = record_address & 0xFFFF;
+
+            // Records can't cross 64K page boundary
+            if (0x10000 - write_addr < write_size)
+                write_size = 0x10000 - write_addr;
+
+            // Line header: REC_SIZE REC_ADDR REC_TYPE
+            buf[0] = write_size;
+            buf[1] = write_addr >> 8;
+            buf[2] = write_addr & 0xFF;
+            buf[3] = static_cast<uint8_t>(RecordType::Data);
+
+            // Advancing forward past header
+            line_length = 4;
+
+            // Copying just enough data to new buffer
+            memcpy(&buf[line_length], &(block->data()[write_pos]), write_size);
+            line_length += write_size;
+
+            // Checksum it all over
+            buf[line_length] = checksum(line_length, buf);
+            line_length++;
 
-            str[line_length * 2 + 1] = '\n';
-            outfile.write(str.data(), line_length * 2 + 2);
+            // Converting to ascii
+            outfile.write(str.data(), encodeRecord(buf, line_length, str, 1));
+            INTELHEX_STAT(m_stats.records++);
 
             // Advancing buffer position
             write_pos += write_size;
         }
         m_state = Result::SUCCESS;
     }
+    // Start address records go just before the end of file marker
+    if (m_hasStartSegment || m_hasStartLinear) {
+        buf[0] = 4;
+        buf[1] = 0;
+        buf[2] = 0;
+    }
+    if (m_hasStartSegment) {
+        //:04'0000'03'CSCS'IPIP'CC
+        buf[3]      = static_cast<uint8_t>(RecordType::StartSegmentAddress);
+        buf[4]      = m_startCS >> 8;
+        buf[5]      = m_startCS & 0xFF;
+        buf[6]      = m_startIP >> 8;
+        buf[7]      = m_startIP & 0xFF;
+        buf[8]      = checksum(8, buf);
+        line_length = 9;
+        outfile.write(str.data(), encodeRecord(buf, line_length, str, 1));
+        INTELHEX_STAT(m_stats.records++);
+    }
+    if (m_hasStartLinear) {
+        //:04'0000'05'EIPEIPEI'CC
+        buf[3]      = static_cast<uint8_t>(RecordType::StartLinearAddress);
+        buf[4]      = m_startEIP >> 24;
+        buf[5]      = m_startEIP >> 16;
+        buf[6]      = m_startEIP >> 8;
+        buf[7]      = m_startEIP & 0xFF;
+        buf[8]      = checksum(8, buf);
+        line_length = 9;
+        outfile.write(str.data(), encodeRecord(buf, line_length, str, 1));
+        INTELHEX_STAT(m_stats.records++);
+    }
+
     // Writing IntelHex end of file marker. -1 for terminating 0
     outfile.write(IHEX_EOF, sizeof(IHEX_EOF) - 1);
-    outfile.close();
-    return m_state;
+    INTELHEX_STAT(m_stats.records++);
+}
+
+void IntelHex::saveSrec(std::ostream &outfile) const
+{
+    RecordBuffer buf;
+    RecordString str;
+    str[0] = 'S';
+
+    auto writeRecord = [&](uint8_t type, uint8_t address_length, uint32_t address, const uint8_t *data, uint8_t size) {
+        str[1]          = '0' + type;
+        uint32_t length = 0;
+        buf[length++]   = address_length + size + 1;
+        for (int i = address_length - 1; i >= 0; i--) {
+            buf[length++] = address >> (i * 8);
+        }
+        if (size > 0)
+            memcpy(&buf[length], data, size);
+        length += size;
+        buf[length] = ~byteSum(length, buf);
+        length++;
+        outfile.write(str.data(), encodeRecord(buf, length, str, 2));
+    };
+
+    // smallest address field that fits the whole image and entry point: S19, S28 or S37
+    uint32_t max_address = m_hasStartLinear ? m_startEIP : 0;
+    if (!m_blocks.empty())
+        max_address = std::max(max_address, maxAddress());
+    uint8_t address_length = 2;
+    if (max_address > 0xFFFFFF)
+        address_length = 4;
+    else if (max_address > 0xFFFF)
+        address_length = 3;
+
+    // S0 header with empty module name
+    writeRecord(0, 2, 0, nullptr, 0);
+
+    // data bytes per record are limited by the one byte count field
+    uint8_t max_size = std::min<uint32_t>(m_lineWidth, 0xFF - address_length - 1);
+    uint32_t records = 0;
+    for (auto block : m_blocks) {
+        uint32_t write_pos = 0;
+        while (block->length() > write_pos) {
+            uint8_t write_size = max_size;
+            if (block->length() - write_pos < write_size)
+                write_size = block->length() - write_pos;
+            writeRecord(address_length - 1,
+                        address_length,
+                        block->address() + write_pos,
+                        block->data() + write_pos,
+                        write_size);
+            write_pos += write_size;
+            records++;
+        }
+    }
+
+    // record count, S5 for 16 bit and S6 for 24 bit counts
+    if (records <= 0xFFFF)
+        writeRecord(5, 2, records, nullptr, 0);
+    else if (records <= 0xFFFFFF)
+        writeRecord(6, 3, records, nullptr, 0);
+
+    // termination record matching the data records: S9, S8 or S7, 0 without an entry point
+    writeRecord(11 - address_length, address_length, m_hasStartLinear ? m_startEIP : 0, nullptr, 0);
+    m_state = Result::SUCCESS;
+}
+
+void IntelHex::saveTiTxt(std::ostream &outfile) const
+{
+    // "@XXXXXXXX\n" or a line of "XX " pairs
+    std::vector<char> str(std::max(11, m_lineWidth * 3));
+    uint64_t next_address = UINT64_MAX;
+
+    for (auto block : m_blocks) {
+        if (block->length() == 0)
+            continue;
+        // contiguous blocks continue the previous section
+        if (block->address() != next_address) {
+            uint32_t address = block->address();
+            int digits       = address > 0xFFFF ? 8 : 4;
+            str[0]           = '@';
+            for (int i = 0; i < digits / 2; i++) {
+                to_hex(address >> ((digits / 2 - 1 - i) * 8), &str[1 + i * 2]);
+            }
+            str[digits + 1] = '\n';
+            outfile.write(str.data(), digits + 2);
+        }
+
+        uint32_t write_pos = 0;
+        while (block->length() > write_pos) {
+            uint32_t write_size = std::min<uint32_t>(m_lineWidth, block->length() - write_pos);
+            for (uint32_t i = 0; i < write_size; i++) {
+                to_hex(block->data()[write_pos + i], &str[i * 3]);
+                str[i * 3 + 2] = ' ';
+            }
+            str[write_size * 3 - 1] = '\n';
+            outfile.write(str.data(), write_size * 3);
+            write_pos += write_size;
+        }
+        next_address = uint64_t(block->address()) + block->length();
+    }
+    outfile.write("q\n", 2);
+    m_state = Result::SUCCESS;
 }
 
 uint8_t IntelHex::get(uint32_t address) const
@@ -506,74 +1528,55 @@ uint8_t &IntelHex::operator[](uint32_t address)
     }
 
     Block *newBlock = new Block();
-    newBlock->set_extended_address(address >> 16);
-    newBlock->set_base_address(address & 0xFFFF);
+    newBlock->set_address(address);
     m_blocks.push_back(newBlock);
     newBlock->add_bytes(&m_fillChar, 1);
     m_cachedBlock = newBlock;
     return newBlock->data()[address - newBlock->address()];
 }
 
-bool inrange(uint32_t value, uint32_t from, uint32_t length)
-{
-    uint32_t to = from + length;
-    return value >= from && value <= to;
-}
-
 void IntelHex::erase(uint32_t address, uint32_t length)
 {
+    uint64_t eraseEnd = uint64_t(address) + length;
+    std::vector<Block *> blocks;
+    blocks.reserve(m_blocks.size() + 1);
+
     for (auto block : m_blocks) {
-        // if the beggining of the block is in the erase region
-        if (inrange(block->address(), address, length)) {
-            // if the ending of the block is in the erase region too
-            // then whole block needs to be erased
-            if (inrange(block->address() + block->length(), address, length)) {
-                // mark to delete later
-                block->set_valid_flag(false);
-            }
-            // otherwise only head needs to be trimmed
-            else {
-                // adjusting address, since Block::erase expects
-                // it to be in the block's boundaries
-                block->erase(block->address(), (address - block->address()) + length);
-            }
+        uint64_t start = block->address();
+        uint64_t end   = start + block->length();
+
+        // block is not touched by the erase region
+        if (end <= address || start >= eraseEnd) {
+            blocks.push_back(block);
+        }
+        // whole block is in the erase region
+        else if (start >= address && end <= eraseEnd) {
+            delete block;
         }
-        // if the ending of the block in the erase region
-        else if (inrange(block->address() + block->length(), address, length)) {
-            block->erase(address, (block->address() + (block->length()) - address + length));
+        // only head needs to be trimmed
+        else if (start >= address) {
+            block->erase(block->address(), eraseEnd - start);
+            blocks.push_back(block);
         }
-        // if the erase region is inside the block
-        // we need to split block into two smaller blocks
-        else if (inrange(address, block->address(), block->length())) {
+        // only tail needs to be trimmed
+        else if (end <= eraseEnd) {
+            block->erase(address, end - address);
+            blocks.push_back(block);
+        }
+        // the erase region is inside the block,
+        // splitting block into two smaller blocks
+        else {
             Block *newBlock = new Block();
-
-            uint32_t newBlockAddress = address + length;
-
-            newBlock->set_base_address(newBlockAddress & 0xFFFF);
-            newBlock->set_extended_address(newBlockAddress >> 16);
-            newBlock->add_bytes(block->data() + (newBlockAddress - block->address()),
-                                block->length() - (newBlockAddress - block->address()));
-            block->erase(address, block->length() - (address - block->address()));
-            auto position = std::find(m_blocks.begin(), m_blocks.end(), block);
-            // adding new block just after current one
-            // TODO: skip re-iteration over new block
-            if (position != m_blocks.end())
-                position++;
-            m_blocks.insert(position, newBlock);
-        }
-    }
-    // clean up blocks marked for deletion
-    // TODO: re-write this part
-    m_blocks.erase(std::remove_if(m_blocks.begin(),
-                                  m_blocks.end(),
-                                  [](const auto block) {
-                                      if (!block->is_valid()) {
-                                          delete block;
-                                          return true;
-                                      }
-                                      return false;
-                                  }),
-                   m_blocks.end());
+            newBlock->set_address(eraseEnd);
+            newBlock->add_bytes(block->data() + (eraseEnd - start), end - eraseEnd);
+            block->erase(address, end - address);
+            blocks.push_back(block);
+            blocks.push_back(newBlock);
+        }
+    }
+    m_blocks.swap(blocks);
+    // cached block might have been deleted
+    m_cachedBlock = nullptr;
 }
 
 uint32_t IntelHex::maxAddress() const
@@ -610,6 +1613,38 @@ uint32_t IntelHex::size() const
     }
 }
 
+IntelHex::MemoryUsage IntelHex::memoryUsage() const
+{
+    MemoryUsage usage;
+    usage.blocks   = m_blocks.size();
+    usage.overhead = m_blocks.capacity() * sizeof(Block *) + m_blocks.size() * sizeof(Block);
+    for (auto block : m_blocks) {
+        usage.payload += block->length();
+        usage.allocated += block->allocated();
+        if (block->mapped())
+            usage.mapped += block->length();
+    }
+    return usage;
+}
+
+void IntelHex::shrinkToFit()
+{
+    // empty blocks are left behind by loads and erases and only cost memory
+    std::vector<Block *> blocks;
+    blocks.reserve(m_blocks.size());
+    for (auto block : m_blocks) {
+        if (block->length() == 0) {
+            delete block;
+            continue;
+        }
+        block->shrink_to_fit();
+        blocks.push_back(block);
+    }
+    blocks.shrink_to_fit();
+    m_blocks      = std::move(blocks);
+    m_cachedBlock = nullptr;
+}
+
 void IntelHex::fill(uint8_t fillChar)
 {
     m_fillChar = fillChar;
@@ -636,3 +1671,1183 @@ bool IntelHex::isSet(uint32_t address, uint8_t &val) const
     }
     return false;
 }
+
+std::vector<Block *> IntelHex::sortedBlocks() const
+{
+    std::vector<Block *> blocks;
+    blocks.reserve(m_blocks.size());
+    for (auto block : m_blocks) {
+        if (block->length() > 0)
+            blocks.push_back(block);
+    }
+    std::sort(blocks.begin(), blocks.end(), [](const Block *a, const Block *b) {
+        return a->address() < b->address();
+    });
+    return blocks;
+}
+
+// chunk compared with a single memcmp before falling back to byte scan
+static const uint32_t DIFF_CHUNK = 64;
+
+static void addDifference(std::vector<IntelHex::Difference> &out,
+                          IntelHex::DiffType type,
+                          uint64_t address,
+                          uint64_t length)
+{
+    // coalescing with the previous range, blocks are split on 64K boundaries
+    if (!out.empty()) {
+        auto &last = out.back();
+        if (last.type == type && uint64_t(last.address) + last.length == address) {
+            last.length += length;
+            return;
+        }
+    }
+    out.push_back({type, uint32_t(address), uint32_t(length)});
+}
+
+// Compares lhs against rhs, or against fill when rhs is null,
+// and reports every mismatching run
+static void compareRun(std::vector<IntelHex::Difference> &out,
+                       IntelHex::DiffType type,
+                       uint64_t address,
+                       uint64_t length,
+                       const uint8_t *lhs,
+                       const uint8_t *rhs,
+                       uint8_t fill)
+{
+    std::array<uint8_t, DIFF_CHUNK> fillBuf;
+    fillBuf.fill(fill);
+
+    uint64_t pos = 0;
+    while (pos < length) {
+        uint64_t chunk = std::min<uint64_t>(DIFF_CHUNK, length - pos);
+        if (memcmp(lhs + pos, rhs ? rhs + pos : fillBuf.data(), chunk) == 0) {
+            pos += chunk;
+            continue;
+        }
+        while (lhs[pos] == (rhs ? rhs[pos] : fill)) {
+            pos++;
+        }
+        uint64_t start = pos;
+        while (pos < length && lhs[pos] != (rhs ? rhs[pos] : fill)) {
+            pos++;
+        }
+        addDifference(out, type, address + start, pos - start);
+    }
+}
+
+std::vector<IntelHex::Difference> IntelHex::diff(const IntelHex &first,
+                                                 const IntelHex &second,
+                                                 bool compareFill)
+{
+    std::vector<Difference> result;
+    auto a = first.sortedBlocks();
+    auto b = second.sortedBlocks();
+
+    const uint64_t none = UINT64_MAX;
+    size_t ia = 0, ib = 0;
+    uint64_t cursor = 0;
+
+    // walking both sorted block lists, cursor is the first address not compared yet
+    while (true) {
+        // overlapping records leave blocks that end before the cursor, not only the one just compared
+        while (ia < a.size() && uint64_t(a[ia]->address()) + a[ia]->length() <= cursor) {
+            ia++;
+        }
+        while (ib < b.size() && uint64_t(b[ib]->address()) + b[ib]->length() <= cursor) {
+            ib++;
+        }
+        if (ia == a.size() && ib == b.size())
+            break;
+
+        uint64_t aStart = none, aEnd = none, bStart = none, bEnd = none;
+        if (ia < a.size()) {
+            aStart = std::max<uint64_t>(a[ia]->address(), cursor);
+            aEnd   = uint64_t(a[ia]->address()) + a[ia]->length();
+        }
+        if (ib < b.size()) {
+            bStart = std::max<uint64_t>(b[ib]->address(), cursor);
+            bEnd   = uint64_t(b[ib]->address()) + b[ib]->length();
+        }
+
+        if (aStart < bStart) {
+            uint64_t end = std::min(aEnd, bStart);
+            const uint8_t *data = a[ia]->data() + (aStart - a[ia]->address());
+            if (compareFill)
+                compareRun(result, DiffType::REMOVED, aStart, end - aStart, data, nullptr, second.m_fillChar);
+            else
+                addDifference(result, DiffType::REMOVED, aStart, end - aStart);
+            cursor = end;
+        }
+        else if (bStart < aStart) {
+            uint64_t end = std::min(bEnd, aStart);
+            const uint8_t *data = b[ib]->data() + (bStart - b[ib]->address());
+            if (compareFill)
+                compareRun(result, DiffType::ADDED, bStart, end - bStart, data, nullptr, first.m_fillChar);
+            else
+                addDifference(result, DiffType::ADDED, bStart, end - bStart);
+            cursor = end;
+        }
+        else {
+            uint64_t end = std::min(aEnd, bEnd);
+            compareRun(result,
+                       DiffType::CHANGED,
+                       aStart,
+                       end - aStart,
+                       a[ia]->data() + (aStart - a[ia]->address()),
+                       b[ib]->data() + (bStart - b[ib]->address()),
+                       0);
+            cursor = end;
+        }
+    }
+    return result;
+}
+
+void IntelHex::write(uint32_t address, const uint8_t *data, uint32_t length)
+{
+    uint64_t end    = uint64_t(address) + length;
+    uint64_t cursor = address;
+    Block *previous = nullptr;
+
+    // populates [cursor, to), appending to the previous block when it ends right at cursor
+    auto fillGap = [&](uint64_t to) {
+        if (previous && uint64_t(previous->address()) + previous->length() == cursor) {
+            previous->add_bytes(data + (cursor - address), to - cursor);
+        }
+        else {
+            Block *newBlock = new Block();
+            newBlock->set_address(cursor);
+            newBlock->add_bytes(data + (cursor - address), to - cursor);
+            m_blocks.push_back(newBlock);
+        }
+        cursor = to;
+    };
+
+    for (auto block : sortedBlocks()) {
+        uint64_t start    = block->address();
+        uint64_t blockEnd = start + block->length();
+        if (blockEnd < cursor)
+            continue;
+        if (start >= end)
+            break;
+        if (start > cursor)
+            fillGap(start);
+        // overwriting populated bytes in place
+        uint64_t to = std::min(blockEnd, end);
+        if (to > cursor) {
+            memcpy(block->data() + (cursor - start), data + (cursor - address), to - cursor);
+            cursor = to;
+        }
+        previous = block;
+    }
+    if (cursor < end)
+        fillGap(end);
+}
+
+// Edits a block list in one pass for edits given in ascending, non-overlapping
+// order: the blocks are sorted once and every edit only touches the blocks it
+// covers, finished blocks move to the result as the edits go past them
+class BlockSplicer {
+public:
+    explicit BlockSplicer(std::vector<Block *> &blocks)
+        : m_target(blocks)
+    {
+        // empty blocks hold nothing and would only get in the way
+        for (auto block : blocks) {
+            if (block->length() > 0)
+                m_pending.push_back(block);
+            else
+                delete block;
+        }
+        std::sort(m_pending.begin(), m_pending.end(), [](const Block *a, const Block *b) {
+            return a->address() < b->address();
+        });
+        m_result.reserve(m_pending.size());
+    }
+
+    // overwrites populated bytes in place, gaps extend the block before them or start a new one
+    void write(uint64_t address, const uint8_t *data, uint64_t length)
+    {
+        uint64_t end    = address + length;
+        uint64_t cursor = address;
+        passBefore(cursor);
+        while (cursor < end) {
+            Block *block = m_next < m_pending.size() ? m_pending[m_next] : nullptr;
+            uint64_t to;
+            if (block && block->address() <= cursor) {
+                to = std::min(blockEnd(block), end);
+                memcpy(block->data() + (cursor - block->address()), data + (cursor - address), to - cursor);
+            }
+            else {
+                to          = block ? std::min<uint64_t>(block->address(), end) : end;
+                Block *last = m_result.empty() ? nullptr : m_result.back();
+                if (!last || blockEnd(last) != cursor) {
+                    last = new Block();
+                    last->set_address(cursor);
+                    m_result.push_back(last);
+                }
+                last->add_bytes(data + (cursor - address), to - cursor);
+            }
+            cursor = to;
+            passBefore(cursor);
+        }
+    }
+
+    void erase(uint64_t address, uint64_t length)
+    {
+        if (length == 0)
+            return;
+        uint64_t end = address + length;
+        passBefore(address);
+        while (m_next < m_pending.size() && m_pending[m_next]->address() < end) {
+            Block *block   = m_pending[m_next];
+            uint64_t start = block->address();
+            uint64_t last  = blockEnd(block);
+            // the erase region is inside the block, the tail stays pending
+            if (start < address && last > end) {
+                Block *tail = new Block();
+                tail->set_address(end);
+                tail->add_bytes(block->data() + (end - start), last - end);
+                block->erase(address, last - address);
+                m_result.push_back(block);
+                m_pending[m_next] = tail;
+                return;
+            }
+            // only the tail needs to be trimmed
+            if (start < address) {
+                block->erase(address, last - address);
+                m_result.push_back(block);
+                m_next++;
+            }
+            // whole block is in the erase region
+            else if (last <= end) {
+                delete block;
+                m_next++;
+            }
+            // only the head needs to be trimmed, what is left starts at end
+            else {
+                block->erase(block->address(), end - start);
+                return;
+            }
+        }
+    }
+
+    // hands the edited list, sorted by address, back to the image
+    void finish()
+    {
+        m_result.insert(m_result.end(), m_pending.begin() + m_next, m_pending.end());
+        m_target.swap(m_result);
+    }
+
+private:
+    static uint64_t blockEnd(const Block *block) { return uint64_t(block->address()) + block->length(); }
+
+    // later edits start at or after address, so blocks ending before it are done
+    void passBefore(uint64_t address)
+    {
+        while (m_next < m_pending.size() && blockEnd(m_pending[m_next]) <= address) {
+            m_result.push_back(m_pending[m_next++]);
+        }
+    }
+
+    std::vector<Block *> &m_target;
+    std::vector<Block *> m_pending;
+    std::vector<Block *> m_result;
+    size_t m_next = 0;
+};
+
+IntelHex::Patch IntelHex::makePatch(const IntelHex &from, const IntelHex &to)
+{
+    Patch patch;
+    auto blocks = to.sortedBlocks();
+    auto block  = blocks.begin();
+    for (const auto &difference : diff(from, to)) {
+        Patch::Record record {};
+        record.address = difference.address;
+        record.length  = difference.length;
+        record.offset  = patch.data.size();
+        switch (difference.type) {
+        case DiffType::CHANGED:
+            record.op = PatchOp::CHANGE;
+            break;
+        case DiffType::REMOVED:
+            record.op = PatchOp::ERASE;
+            break;
+        case DiffType::ADDED:
+            record.op = PatchOp::ADD;
+            break;
+        }
+        if (record.op != PatchOp::ERASE) {
+            uint64_t recordEnd = uint64_t(record.address) + record.length;
+            patch.data.resize(record.offset + record.length);
+            // differences are sorted, so the blocks of to are walked only once
+            while (block != blocks.end() && uint64_t((*block)->address()) + (*block)->length() <= record.address) {
+                block++;
+            }
+            for (auto it = block; it != blocks.end() && (*it)->address() < recordEnd; it++) {
+                uint64_t start = std::max((*it)->address(), record.address);
+                uint64_t end   = std::min<uint64_t>(uint64_t((*it)->address()) + (*it)->length(), recordEnd);
+                if (start < end) {
+                    memcpy(&patch.data[record.offset + (start - record.address)],
+                           (*it)->data() + (start - (*it)->address()),
+                           end - start);
+                }
+            }
+        }
+        patch.records.push_back(record);
+    }
+    return patch;
+}
+
+IntelHex::Result IntelHex::apply(const Patch &patch)
+{
+    for (const auto &record : patch.records) {
+        if (record.op != PatchOp::ERASE &&
+            uint64_t(record.offset) + record.length > patch.data.size()) {
+            return Result::INCORRECT_FILE;
+        }
+    }
+
+    // patches from makePatch() are in address order and spliced in a single pass,
+    // hand-made ones in any other order go through write() and erase() record by record
+    bool ordered = true;
+    uint64_t end = 0;
+    for (const auto &record : patch.records) {
+        ordered = ordered && record.address >= end;
+        end     = uint64_t(record.address) + record.length;
+    }
+    if (!ordered) {
+        for (const auto &record : patch.records) {
+            switch (record.op) {
+            case PatchOp::CHANGE:
+            case PatchOp::ADD:
+                write(record.address, &patch.data[record.offset], record.length);
+                break;
+            case PatchOp::ERASE:
+                erase(record.address, record.length);
+                break;
+            }
+        }
+        return Result::SUCCESS;
+    }
+
+    BlockSplicer splicer(m_blocks);
+    for (const auto &record : patch.records) {
+        switch (record.op) {
+        case PatchOp::CHANGE:
+        case PatchOp::ADD:
+            splicer.write(record.address, &patch.data[record.offset], record.length);
+            break;
+        case PatchOp::ERASE:
+            splicer.erase(record.address, record.length);
+            break;
+        }
+    }
+    splicer.finish();
+    m_cachedBlock = nullptr;
+    return Result::SUCCESS;
+}
+
+// Serialized patch, all values little endian:
+// 'IHXP' version:u8 reserved:u8[3] count:u32
+// count records of op:u8 address:u32 length:u32 [length bytes unless ERASE]
+static const char PATCH_MAGIC[] = "IHXP";
+static const uint8_t PATCH_VERSION = 1;
+
+static void put_u32(std::vector<uint8_t> &out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        out.push_back(value >> (i * 8));
+    }
+}
+
+static uint32_t get_u32(const uint8_t *in)
+{
+    return in[0] | (in[1] << 8) | (in[2] << 16) | (uint32_t(in[3]) << 24);
+}
+
+std::vector<uint8_t> IntelHex::Patch::serialize() const
+{
+    std::vector<uint8_t> out;
+    out.reserve(12 + records.size() * 9 + data.size());
+    for (int i = 0; i < 4; i++) {
+        out.push_back(PATCH_MAGIC[i]);
+    }
+    out.push_back(PATCH_VERSION);
+    out.insert(out.end(), 3, 0);
+    put_u32(out, records.size());
+    for (const auto &record : records) {
+        out.push_back(static_cast<uint8_t>(record.op));
+        put_u32(out, record.address);
+        put_u32(out, record.length);
+        if (record.op != PatchOp::ERASE)
+            out.insert(out.end(), &data[record.offset], &data[record.offset] + record.length);
+    }
+    return out;
+}
+
+IntelHex::Result IntelHex::Patch::deserialize(const std::vector<uint8_t> &input, Patch &patch)
+{
+    patch.records.clear();
+    patch.data.clear();
+    if (input.size() < 12 || memcmp(input.data(), PATCH_MAGIC, 4) != 0)
+        return Result::INCORRECT_FILE;
+    if (input[4] != PATCH_VERSION)
+        return Result::UNSUPPORTED_FORMAT;
+
+    uint32_t count = get_u32(&input[8]);
+    size_t pos     = 12;
+    for (uint32_t i = 0; i < count; i++) {
+        if (input.size() - pos < 9)
+            return Result::INCORRECT_FILE;
+        Record record;
+        record.op      = static_cast<PatchOp>(input[pos]);
+        record.address = get_u32(&input[pos + 1]);
+        record.length  = get_u32(&input[pos + 5]);
+        record.offset  = patch.data.size();
+        pos += 9;
+        if (record.op > PatchOp::ADD)
+            return Result::INCORRECT_FILE;
+        if (record.op != PatchOp::ERASE) {
+            if (input.size() - pos < record.length)
+                return Result::INCORRECT_FILE;
+            patch.data.insert(patch.data.end(), &input[pos], &input[pos] + record.length);
+            pos += record.length;
+        }
+        patch.records.push_back(record);
+    }
+    return Result::SUCCESS;
+}
+
+IntelHex::Result IntelHex::merge(const IntelHex &other, MergePolicy policy)
+{
+    std::vector<Range> conflicts;
+    return merge(other, policy, conflicts);
+}
+
+IntelHex::Result IntelHex::merge(const IntelHex &other,
+                                 MergePolicy policy,
+                                 std::vector<Range> &conflicts)
+{
+    conflicts.clear();
+    auto differences = diff(*this, other);
+    for (const auto &difference : differences) {
+        if (difference.type == DiffType::CHANGED)
+            conflicts.push_back({difference.address, difference.length});
+    }
+    if (policy == MergePolicy::FAIL && !conflicts.empty())
+        return Result::CONFLICT;
+
+    // taken before the splicer drops empty blocks, other may be this image
+    auto blocks = other.sortedBlocks();
+    auto block  = blocks.begin();
+    // differences are sorted, so this image's blocks are spliced in one pass as well
+    BlockSplicer splicer(m_blocks);
+    for (const auto &difference : differences) {
+        if (difference.type == DiffType::REMOVED ||
+            (difference.type == DiffType::CHANGED && policy != MergePolicy::OVERWRITE)) {
+            continue;
+        }
+        uint64_t end = uint64_t(difference.address) + difference.length;
+        // differences are sorted, so other's blocks are walked only once
+        while (block != blocks.end() && uint64_t((*block)->address()) + (*block)->length() <= difference.address) {
+            block++;
+        }
+        for (auto it = block; it != blocks.end() && (*it)->address() < end; it++) {
+            uint64_t from = std::max((*it)->address(), difference.address);
+            uint64_t to   = std::min<uint64_t>(uint64_t((*it)->address()) + (*it)->length(), end);
+            splicer.write(from, (*it)->data() + (from - (*it)->address()), to - from);
+        }
+    }
+    splicer.finish();
+    m_cachedBlock = nullptr;
+    return Result::SUCCESS;
+}
+
+IntelHex::BatchResult IntelHex::loadBatch(const std::vector<fs::path> &paths, unsigned workers)
+{
+    using clock = std::chrono::steady_clock;
+
+    BatchResult batch;
+    batch.images.resize(paths.size());
+    batch.results.resize(paths.size(), Result::UNKNOWN);
+
+    if (workers == 0)
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    if (workers > paths.size())
+        workers = std::max<size_t>(1, paths.size());
+    batch.workers = workers;
+
+    std::atomic<size_t> next(0);
+    std::atomic<clock::rep> loadTime(0);
+    auto worker = [&]() {
+        clock::duration busy(0);
+        // files are handed out one at a time, so slow files don't stall a whole worker share
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            auto start       = clock::now();
+            batch.results[i] = batch.images[i].load(paths[i]);
+            busy += clock::now() - start;
+        }
+        loadTime += busy.count();
+    };
+
+    auto start = clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < workers; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    batch.wallTime = clock::now() - start;
+    batch.loadTime = clock::duration(loadTime.load());
+    return batch;
+}
+
+// chunk size used to stream flat images to disk
+static const uint32_t BINARY_CHUNK = 1 << 20;
+
+// Copies [start, end) from blocks sorted by address, filling gaps.
+// Returns index of the first block that might still overlap further addresses
+static size_t copyRange(const std::vector<Block *> &blocks,
+                        size_t first,
+                        uint64_t start,
+                        uint64_t end,
+                        uint8_t *out,
+                        uint8_t fill)
+{
+    uint64_t cursor = start;
+    size_t i        = first;
+    for (; i < blocks.size() && cursor < end; i++) {
+        uint64_t blockStart = blocks[i]->address();
+        uint64_t blockEnd   = blockStart + blocks[i]->length();
+        if (blockEnd <= cursor)
+            continue;
+        if (blockStart >= end)
+            break;
+        if (blockStart > cursor) {
+            memset(out + (cursor - start), fill, blockStart - cursor);
+            cursor = blockStart;
+        }
+        uint64_t to = std::min(blockEnd, end);
+        memcpy(out + (cursor - start), blocks[i]->data() + (cursor - blockStart), to - cursor);
+        cursor = to;
+        if (blockEnd > end)
+            break;
+    }
+    if (cursor < end)
+        memset(out + (cursor - start), fill, end - cursor);
+    return i;
+}
+
+void IntelHex::toBinary(uint32_t start, uint64_t end, uint8_t *out) const
+{
+    if (end <= start)
+        return;
+    copyRange(sortedBlocks(), 0, start, end, out, m_fillChar);
+}
+
+IntelHex::Result IntelHex::saveBinary(const fs::path &path) const
+{
+    // empty blocks are left out, minAddress() and maxAddress() would count them
+    auto blocks = sortedBlocks();
+    if (blocks.empty())
+        return saveBinary(path, 0, 0);
+    uint64_t end = 0;
+    for (auto block : blocks) {
+        end = std::max(end, uint64_t(block->address()) + block->length());
+    }
+    return saveBinary(path, blocks.front()->address(), end);
+}
+
+IntelHex::Result IntelHex::saveBinary(const fs::path &path, uint32_t start, uint64_t end) const
+{
+    std::ofstream outfile(path, std::ios::binary);
+    if (!outfile.is_open()) {
+        m_state = Result::FILE_NOT_FOUND;
+        return m_state;
+    }
+
+    auto blocks = sortedBlocks();
+    std::vector<uint8_t> chunk(std::min<uint64_t>(BINARY_CHUNK, end > start ? end - start : 0));
+    size_t first = 0;
+    for (uint64_t address = start; address < end; address += chunk.size()) {
+        uint64_t to = std::min<uint64_t>(address + chunk.size(), end);
+        first       = copyRange(blocks, first, address, to, chunk.data(), m_fillChar);
+        outfile.write(reinterpret_cast<const char *>(chunk.data()), to - address);
+    }
+    outfile.close();
+    m_state = outfile ? Result::SUCCESS : Result::FILE_NOT_FOUND;
+    return m_state;
+}
+
+// runs of fill bytes at least this long are not stored in sparse mode
+static const uint32_t SPARSE_FILL_RUN = 32;
+
+IntelHex::Result IntelHex::fromBinary(const uint8_t *data,
+                                      size_t length,
+                                      uint32_t baseAddress,
+                                      bool sparse)
+{
+    clear();
+    if (uint64_t(baseAddress) + length > 0x100000000ULL) {
+        m_state = Result::UNSUPPORTED_FORMAT;
+        return m_state;
+    }
+
+    auto addBlock = [&](size_t from, size_t to) {
+        if (to <= from)
+            return;
+        Block *block = new Block();
+        block->set_address(baseAddress + from);
+        block->add_bytes(data + from, to - from);
+        m_blocks.push_back(block);
+    };
+
+    if (!sparse) {
+        addBlock(0, length);
+    }
+    else {
+        size_t blockStart = 0;
+        size_t pos        = 0;
+        while (pos < length) {
+            if (data[pos] != m_fillChar) {
+                pos++;
+                continue;
+            }
+            size_t runStart = pos;
+            while (pos < length && data[pos] == m_fillChar) {
+                pos++;
+            }
+            if (pos - runStart >= SPARSE_FILL_RUN) {
+                addBlock(blockStart, runStart);
+                blockStart = pos;
+            }
+        }
+        addBlock(blockStart, length);
+    }
+    m_state = Result::SUCCESS;
+    return m_state;
+}
+
+IntelHex::Result IntelHex::loadBinary(const fs::path &path, uint32_t baseAddress, bool sparse)
+{
+    clear();
+    std::ifstream infile(path, std::ios::binary | std::ios::ate);
+    if (!infile.is_open()) {
+        m_state = Result::FILE_NOT_FOUND;
+        return m_state;
+    }
+    uint64_t length = infile.tellg();
+    infile.seekg(0);
+    if (baseAddress + length > 0x100000000ULL) {
+        m_state = Result::UNSUPPORTED_FORMAT;
+        return m_state;
+    }
+
+    if (sparse) {
+        std::vector<uint8_t> data(length);
+        infile.read(reinterpret_cast<char *>(data.data()), length);
+        if (!infile) {
+            m_state = Result::INCORRECT_FILE;
+            return m_state;
+        }
+        return fromBinary(data.data(), data.size(), baseAddress, true);
+    }
+
+    // reading straight into the block storage, no intermediate buffer
+    Block *block = new Block();
+    block->set_address(baseAddress);
+    uint8_t *data = block->resize(length);
+    if (length > 0 && (data == nullptr || !infile.read(reinterpret_cast<char *>(data), length))) {
+        delete block;
+        m_state = Result::INCORRECT_FILE;
+        return m_state;
+    }
+    m_blocks.push_back(block);
+    m_state = Result::SUCCESS;
+    return m_state;
+}
+
+// UF2 block layout, all fields little endian
+static const uint32_t UF2_BLOCK_SIZE     = 512;
+static const uint32_t UF2_PAYLOAD_SIZE   = 256;
+static const uint32_t UF2_DATA_SIZE      = 476;
+static const uint32_t UF2_MAGIC_START0   = 0x0A324655;
+static const uint32_t UF2_MAGIC_START1   = 0x9E5D5157;
+static const uint32_t UF2_MAGIC_END      = 0x0AB16F30;
+static const uint32_t UF2_NOT_MAIN_FLASH = 0x00000001;
+static const uint32_t UF2_FILE_CONTAINER = 0x00001000;
+static const uint32_t UF2_FAMILY_ID      = 0x00002000;
+
+static void set_u32(uint8_t *out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        out[i] = value >> (i * 8);
+    }
+}
+
+IntelHex::Result IntelHex::parseUf2(std::istream &input)
+{
+    std::array<uint8_t, UF2_BLOCK_SIZE> buf;
+    Block *currentBlock = new Block();
+    bool familySeen     = false;
+
+    while (input.read(reinterpret_cast<char *>(buf.data()), buf.size())) {
+        uint32_t flags   = get_u32(&buf[8]);
+        uint32_t address = get_u32(&buf[12]);
+        uint32_t size    = get_u32(&buf[16]);
+        if (get_u32(&buf[0]) != UF2_MAGIC_START0 || get_u32(&buf[4]) != UF2_MAGIC_START1 ||
+            get_u32(&buf[UF2_BLOCK_SIZE - 4]) != UF2_MAGIC_END || size > UF2_DATA_SIZE ||
+            uint64_t(address) + size > 0x100000000ULL) {
+            delete currentBlock;
+            m_state = Result::INCORRECT_FILE;
+            return m_state;
+        }
+        // blocks for other memories and embedded files are not part of the image
+        if (flags & (UF2_NOT_MAIN_FLASH | UF2_FILE_CONTAINER))
+            continue;
+        if ((flags & UF2_FAMILY_ID) && !familySeen) {
+            m_uf2FamilyId = get_u32(&buf[28]);
+            familySeen    = true;
+        }
+        appendRecord(m_blocks, currentBlock, address, &buf[32], size);
+    }
+
+    // trailing partial block means truncated file
+    if (input.gcount() != 0) {
+        delete currentBlock;
+        m_state = Result::INCORRECT_FILE;
+        return m_state;
+    }
+    m_blocks.push_back(currentBlock);
+    m_state = Result::SUCCESS;
+    return m_state;
+}
+
+void IntelHex::toUf2(std::vector<uint8_t> &out) const
+{
+    auto blocks = sortedBlocks();
+
+    // 256 byte aligned pages touched by any block, counted first to size the output
+    std::vector<uint32_t> pages;
+    for (auto block : blocks) {
+        uint64_t page = block->address() & ~(UF2_PAYLOAD_SIZE - 1);
+        uint64_t end  = uint64_t(block->address()) + block->length();
+        if (!pages.empty() && pages.back() == page)
+            page += UF2_PAYLOAD_SIZE;
+        for (; page < end; page += UF2_PAYLOAD_SIZE) {
+            pages.push_back(page);
+        }
+    }
+
+    out.assign(pages.size() * UF2_BLOCK_SIZE, 0);
+    uint32_t flags = m_uf2FamilyId ? UF2_FAMILY_ID : 0;
+    size_t first   = 0;
+    for (size_t i = 0; i < pages.size(); i++) {
+        uint8_t *buf = &out[i * UF2_BLOCK_SIZE];
+        set_u32(&buf[0], UF2_MAGIC_START0);
+        set_u32(&buf[4], UF2_MAGIC_START1);
+        set_u32(&buf[8], flags);
+        set_u32(&buf[12], pages[i]);
+        set_u32(&buf[16], UF2_PAYLOAD_SIZE);
+        set_u32(&buf[20], i);
+        set_u32(&buf[24], pages.size());
+        set_u32(&buf[28], m_uf2FamilyId);
+        first = copyRange(blocks, first, pages[i], uint64_t(pages[i]) + UF2_PAYLOAD_SIZE, &buf[32], m_fillChar);
+        set_u32(&buf[UF2_BLOCK_SIZE - 4], UF2_MAGIC_END);
+    }
+}
+
+void IntelHex::setUf2FamilyId(uint32_t familyId)
+{
+    m_uf2FamilyId = familyId;
+}
+
+uint32_t IntelHex::uf2FamilyId() const
+{
+    return m_uf2FamilyId;
+}
+
+bool IntelHex::startSegmentAddress(uint16_t &cs, uint16_t &ip) const
+{
+    cs = m_startCS;
+    ip = m_startIP;
+    return m_hasStartSegment;
+}
+
+void IntelHex::setStartSegmentAddress(uint16_t cs, uint16_t ip)
+{
+    m_hasStartSegment = true;
+    m_startCS         = cs;
+    m_startIP         = ip;
+}
+
+bool IntelHex::startLinearAddress(uint32_t &address) const
+{
+    address = m_startEIP;
+    return m_hasStartLinear;
+}
+
+void IntelHex::setStartLinearAddress(uint32_t address)
+{
+    m_hasStartLinear = true;
+    m_startEIP       = address;
+}
+
+void IntelHex::clearStartAddress()
+{
+    m_hasStartSegment = false;
+    m_hasStartLinear  = false;
+}
+
+void IntelHex::setStrict(bool strict)
+{
+    m_strict = strict;
+}
+
+// Native format, all values little endian:
+//   "IHXN", u16 version, u16 header size, u32 payload alignment, u32 block count,
+//   u8 flags (1 start segment set, 2 start linear set), u8 reserved, u16 CS, u16 IP,
+//   u16 reserved, u32 EIP, u32 reserved, u64 payload bytes, u64 file size,
+//   zeros up to the header size
+// then a table of u32 address, u32 length and u64 offset per block sorted by
+// address, then the payloads, each at an offset that is a multiple of the alignment.
+// Offsets are relative to the header, so the image can be embedded at an aligned
+// position of a larger file.
+
+static const uint8_t NATIVE_MAGIC[]       = {'I', 'H', 'X', 'N'};
+static const uint16_t NATIVE_VERSION      = 1;
+static const uint16_t NATIVE_HEADER_SIZE  = 64;
+static const uint32_t NATIVE_ALIGNMENT    = 64; // a cache line, pages would waste too much on sparse images
+static const uint32_t NATIVE_ENTRY_SIZE   = 16;
+static const uint8_t NATIVE_START_SEGMENT = 1;
+static const uint8_t NATIVE_START_LINEAR  = 2;
+
+static void put_u16(std::vector<uint8_t> &out, uint16_t value)
+{
+    out.push_back(value & 0xFF);
+    out.push_back(value >> 8);
+}
+
+static uint16_t get_u16(const uint8_t *in)
+{
+    return in[0] | (in[1] << 8);
+}
+
+static void put_u64(std::vector<uint8_t> &out, uint64_t value)
+{
+    for (int i = 0; i < 8; i++) {
+        out.push_back(value >> (i * 8));
+    }
+}
+
+static uint64_t get_u64(const uint8_t *in)
+{
+    return get_u32(in) | (uint64_t(get_u32(in + 4)) << 32);
+}
+
+static uint64_t alignNative(uint64_t offset)
+{
+    return (offset + NATIVE_ALIGNMENT - 1) & ~uint64_t(NATIVE_ALIGNMENT - 1);
+}
+
+// Sibling of target to write to before renaming it into place, named after the
+// process ID and a per process counter, so concurrent writers never share one
+static fs::path temporaryPath(const fs::path &target)
+{
+    static std::atomic<uint32_t> counter(0);
+#if defined(INTELHEX_MMAP)
+    auto process = getpid();
+#elif defined(_WIN32)
+    auto process = _getpid();
+#else
+    // no process ID to be had, the thread hash only makes a clash unlikely
+    auto process = std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+    fs::path temporary = target;
+    temporary += "." + std::to_string(process) + "." + std::to_string(counter++) + ".tmp";
+    return temporary;
+}
+
+// Empty blocks are left out, they hold nothing and would only break the ordering
+void IntelHex::writeNative(std::ostream &output) const
+{
+    std::vector<Block *> blocks;
+    uint64_t payload = 0;
+    for (auto block : sortedBlocks()) {
+        if (block->length() == 0)
+            continue;
+        blocks.push_back(block);
+        payload += block->length();
+    }
+
+    std::vector<uint8_t> table;
+    uint64_t offset = alignNative(NATIVE_HEADER_SIZE + uint64_t(blocks.size()) * NATIVE_ENTRY_SIZE);
+    for (auto block : blocks) {
+        put_u32(table, block->address());
+        put_u32(table, block->length());
+        put_u64(table, offset);
+        offset = alignNative(offset + block->length());
+    }
+    uint64_t fileSize = NATIVE_HEADER_SIZE;
+    if (!blocks.empty())
+        fileSize = get_u64(&table[table.size() - 8]) + blocks.back()->length();
+
+    std::vector<uint8_t> header(NATIVE_MAGIC, NATIVE_MAGIC + 4);
+    put_u16(header, NATIVE_VERSION);
+    put_u16(header, NATIVE_HEADER_SIZE);
+    put_u32(header, NATIVE_ALIGNMENT);
+    put_u32(header, blocks.size());
+    header.push_back((m_hasStartSegment ? NATIVE_START_SEGMENT : 0) | (m_hasStartLinear ? NATIVE_START_LINEAR : 0));
+    header.push_back(0);
+    put_u16(header, m_startCS);
+    put_u16(header, m_startIP);
+    put_u16(header, 0);
+    put_u32(header, m_startEIP);
+    put_u32(header, 0);
+    put_u64(header, payload);
+    put_u64(header, fileSize);
+    header.resize(NATIVE_HEADER_SIZE, 0);
+    header.insert(header.end(), table.begin(), table.end());
+
+    static const char padding[NATIVE_ALIGNMENT] = {};
+    output.write(reinterpret_cast<const char *>(header.data()), header.size());
+    uint64_t position = header.size();
+    for (auto block : blocks) {
+        output.write(padding, alignNative(position) - position);
+        output.write(reinterpret_cast<const char *>(block->data()), block->length());
+        position = alignNative(position) + block->length();
+    }
+}
+
+// Builds blocks from a native image of size bytes, either pointing into the
+// mapping data belongs to or, without one, copied. Nothing is added unless the
+// whole image is consistent.
+IntelHex::Result IntelHex::readNative(uint8_t *data, size_t size, const std::shared_ptr<MappedFile> &mapping)
+{
+    if (size < NATIVE_HEADER_SIZE || memcmp(data, NATIVE_MAGIC, 4) != 0 || get_u16(data + 4) != NATIVE_VERSION)
+        return Result::INCORRECT_FILE;
+    uint16_t headerSize = get_u16(data + 6);
+    uint32_t count      = get_u32(data + 12);
+    if (headerSize < NATIVE_HEADER_SIZE || headerSize > size || get_u64(data + 40) != size ||
+        count > (size - headerSize) / NATIVE_ENTRY_SIZE)
+        return Result::INCORRECT_FILE;
+
+    // blocks must be sorted, apart and inside the file before any is built
+    const uint8_t *entry = data + headerSize;
+    uint64_t end         = 0;
+    uint64_t payload     = 0;
+    for (uint32_t i = 0; i < count; i++, entry += NATIVE_ENTRY_SIZE) {
+        uint32_t address = get_u32(entry);
+        uint32_t length  = get_u32(entry + 4);
+        uint64_t offset  = get_u64(entry + 8);
+        if ((i > 0 && address < end) || length == 0 || offset > size || size - offset < length)
+            return Result::INCORRECT_FILE;
+        end = uint64_t(address) + length;
+        payload += length;
+    }
+    if (end > 0x100000000ULL || get_u64(data + 32) != payload)
+        return Result::INCORRECT_FILE;
+
+    entry = data + headerSize;
+    for (uint32_t i = 0; i < count; i++, entry += NATIVE_ENTRY_SIZE) {
+        uint32_t length = get_u32(entry + 4);
+        uint8_t *bytes  = data + get_u64(entry + 8);
+        Block *block    = new Block();
+        block->set_address(get_u32(entry));
+        if (mapping)
+            block->map(mapping, bytes, length);
+        else
+            memcpy(block->resize(length), bytes, length);
+        m_blocks.push_back(block);
+    }
+    m_hasStartSegment = data[16] & NATIVE_START_SEGMENT;
+    m_hasStartLinear  = data[16] & NATIVE_START_LINEAR;
+    m_startCS         = get_u16(data + 18);
+    m_startIP         = get_u16(data + 20);
+    m_startEIP        = get_u32(data + 24);
+    return Result::SUCCESS;
+}
+
+IntelHex::Result IntelHex::parseNative(std::istream &input)
+{
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    m_state = readNative(data.data(), data.size(), nullptr);
+    return m_state;
+}
+
+// Native files are likely mapped, by blocks of this very image or by other
+// processes, so the file is replaced by rename instead of being truncated under them
+IntelHex::Result IntelHex::saveNative(const fs::path &path) const
+{
+    fs::path temporary = temporaryPath(path);
+    std::ofstream outfile(temporary, std::ios::binary);
+    if (!outfile.is_open()) {
+        m_state = Result::FILE_NOT_FOUND;
+        return m_state;
+    }
+    writeNative(outfile);
+    outfile.close();
+
+    std::error_code error;
+    if (outfile.good())
+        fs::rename(temporary, path, error);
+    if (!outfile.good() || error) {
+        fs::remove(temporary, error);
+        m_state = Result::FILE_NOT_FOUND;
+        return m_state;
+    }
+    m_state = Result::SUCCESS;
+    return m_state;
+}
+
+IntelHex::Result IntelHex::loadNative(const fs::path &path)
+{
+    m_diagnostics = Diagnostics();
+    m_damaged.clear();
+    INTELHEX_STAT(StatsScope scope(m_stats, m_blocks));
+    auto mapping = std::make_shared<MappedFile>(path, true);
+    m_state      = mapping->isOpen() ? readNative(mapping->data(), mapping->size(), mapping) : Result::FILE_NOT_FOUND;
+    return m_state;
+}
+
+// Sidecar cache
+//
+// A cache file is named after the hash of the source's absolute path and holds
+// the key it was written for, followed by the image, all little endian:
+//   "IHXC", u32 version
+//   u64 source size, i64 source mtime, u64 content hash,
+//   u8 format, u8 strict, u8 lenient, u8 reserved,
+//   u32 UF2 family ID before and u32 after the load, u32 path length, path
+//   zeros up to a multiple of the native alignment, then the image in native format
+// A load uses it only when every key field matches and maps the image in place,
+// files are replaced by rename so readers never see a partly written cache.
+
+static const uint8_t CACHE_MAGIC[]  = {'I', 'H', 'X', 'C'};
+static const uint32_t CACHE_VERSION = 3;
+
+// 64 bit words are mixed in with multiply and rotate, enough to tell file
+// versions apart at memory speed, not meant to resist deliberate collisions
+static uint64_t contentHash(const uint8_t *data, size_t size)
+{
+    const uint64_t k0 = 0x9E3779B97F4A7C15ull;
+    const uint64_t k1 = 0xC2B2AE3D27D4EB4Full;
+    uint64_t hash     = size * k0;
+    size_t i          = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash ^= word * k1;
+        hash = ((hash << 31) | (hash >> 33)) * k0;
+    }
+    uint64_t tail = 0;
+    for (size_t shift = 0; i < size; i++, shift += 8) {
+        tail |= uint64_t(data[i]) << shift;
+    }
+    hash ^= tail * k1;
+    hash ^= hash >> 29;
+    hash *= k1;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Everything a cached image depends on, false if the source can't be read
+bool IntelHex::cacheKey(const fs::path &path, Format format, CacheKey &key) const
+{
+    std::error_code error;
+    auto mtime = fs::last_write_time(path, error);
+    if (error)
+        return false;
+    MappedFile source(path);
+    if (!source.isOpen())
+        return false;
+
+    key.source  = fs::absolute(path, error).lexically_normal().string();
+    key.size    = source.size();
+    key.mtime   = mtime.time_since_epoch().count();
+    key.hash    = contentHash(source.data(), source.size());
+    key.format  = static_cast<uint8_t>(format);
+    key.strict  = m_strict;
+    key.lenient = m_lenient;
+    if (format == Format::UF2)
+        key.uf2FamilyId = m_uf2FamilyId;
+
+    char name[24];
+    auto pathHash = contentHash(reinterpret_cast<const uint8_t *>(key.source.data()), key.source.size());
+    snprintf(name, sizeof(name), "%016llx.ihxc", static_cast<unsigned long long>(pathHash));
+    key.file = m_cacheDirectory / name;
+    return true;
+}
+
+bool IntelHex::readCache(const CacheKey &key)
+{
+    auto cache        = std::make_shared<MappedFile>(key.file, true);
+    const uint8_t *in = cache->data();
+    if (!cache->isOpen() || cache->size() < 48 || memcmp(in, CACHE_MAGIC, 4) != 0 ||
+        get_u32(in + 4) != CACHE_VERSION)
+        return false;
+
+    uint32_t pathLength = get_u32(in + 44);
+    uint64_t prefix     = alignNative(48 + uint64_t(pathLength));
+    if (get_u64(in + 8) != key.size || int64_t(get_u64(in + 16)) != key.mtime ||
+        get_u64(in + 24) != key.hash || in[32] != key.format || in[33] != key.strict ||
+        in[34] != key.lenient || get_u32(in + 36) != key.uf2FamilyId || pathLength != key.source.size() ||
+        cache->size() < prefix || memcmp(in + 48, key.source.data(), pathLength) != 0)
+        return false;
+    if (readNative(cache->data() + prefix, cache->size() - prefix, cache) != Result::SUCCESS)
+        return false;
+    if (key.format == static_cast<uint8_t>(Format::UF2))
+        m_uf2FamilyId = get_u32(in + 40);
+    return true;
+}
+
+// Failing to write the cache never fails the load, the next load just parses again
+void IntelHex::writeCache(const CacheKey &key) const
+{
+    std::vector<uint8_t> header(CACHE_MAGIC, CACHE_MAGIC + 4);
+    put_u32(header, CACHE_VERSION);
+    put_u64(header, key.size);
+    put_u64(header, key.mtime);
+    put_u64(header, key.hash);
+    header.push_back(key.format);
+    header.push_back(key.strict);
+    header.push_back(key.lenient);
+    header.push_back(0);
+    put_u32(header, key.uf2FamilyId);
+    put_u32(header, m_uf2FamilyId);
+    put_u32(header, key.source.size());
+    header.insert(header.end(), key.source.begin(), key.source.end());
+    // keeps the native payloads aligned in the mapping
+    header.resize(alignNative(header.size()), 0);
+
+    std::error_code error;
+    fs::create_directories(m_cacheDirectory, error);
+    fs::path temporary = temporaryPath(key.file);
+
+    std::ofstream file(temporary, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(header.data()), header.size());
+    writeNative(file);
+    file.close();
+
+    if (file.good())
+        fs::rename(temporary, key.file, error);
+    if (!file.good() || error)
+        fs::remove(temporary, error);
+}
+
+void IntelHex::setCacheDirectory(const fs::path &directory)
+{
+    m_cacheDirectory = directory;
+}
+
+const fs::path &IntelHex::cacheDirectory() const
+{
+    return m_cacheDirectory;
+}
+
+bool IntelHex::loadedFromCache() const
+{
+    return m_loadedFromCache;
+}
@@ -24,12 +24,15 @@
 
 #ifndef __INTELHEX_H
 
+#include <chrono>
+#include <memory>
 #include <vector>
 #include "std_compat.h"
 
 namespace IntelHexNS {
 
 struct Block;
+class MappedFile;
 
 class IntelHex {
 public:
@@ -41,6 +44,119 @@ public:
         FILE_NOT_FOUND,
         INCORRECT_FILE,
         UNSUPPORTED_FORMAT,
+        CONFLICT,
+    };
+
+    enum class Format
+    {
+        AUTO, // detected from the first bytes on load, Intel HEX on save
+        INTEL_HEX,
+        SREC, // Motorola S-record, S19/S28/S37
+        TI_TXT, // TI-TXT used by MSP430 toolchains
+        ELF,    // PT_LOAD segments of ELF32/ELF64 by physical address, load only
+        UF2,    // 256 byte payload blocks, family ID from setUf2FamilyId()
+        BINARY, // raw image starting at address 0
+        NATIVE, // versioned block dump, files are loaded in place through mmap
+    };
+
+    enum class MergePolicy
+    {
+        FAIL,       // leave image untouched if any populated byte differs
+        KEEP_FIRST, // keep bytes already present in the image
+        OVERWRITE,  // take bytes from the merged image
+    };
+
+    struct Range
+    {
+        uint32_t address;
+        uint32_t length;
+    };
+
+    enum class DiffType
+    {
+        CHANGED, // populated in both images, contents differ
+        REMOVED, // populated in the first image only
+        ADDED,   // populated in the second image only
+    };
+
+    struct Difference
+    {
+        DiffType type;
+        uint32_t address;
+        uint32_t length;
+    };
+
+    enum class PatchOp : uint8_t
+    {
+        CHANGE, // overwrite populated bytes
+        ERASE,  // remove populated bytes
+        ADD,    // populate new bytes
+    };
+
+    struct Patch
+    {
+        struct Record
+        {
+            PatchOp op;
+            uint32_t address;
+            uint32_t length;
+            uint32_t offset; // position of the record's bytes in data
+        };
+
+        std::vector<Record> records;
+        std::vector<uint8_t> data;
+
+        std::vector<uint8_t> serialize() const;
+        static Result deserialize(const std::vector<uint8_t> &input, Patch &patch);
+    };
+
+    struct BatchResult;
+
+    enum class ParseError
+    {
+        NONE,
+        BAD_START_CODE,
+        BAD_HEX_DIGIT,
+        LENGTH_MISMATCH,
+        BAD_CHECKSUM,
+        BAD_RECORD_TYPE,
+        BAD_RECORD, // address or start record with wrong length
+        MISSING_END,
+    };
+
+    // Where the last load stopped, filled only when it failed
+    struct Diagnostics
+    {
+        ParseError error = ParseError::NONE;
+        uint32_t line    = 0; // 1-based
+        uint32_t column  = 0; // 1-based, 0 if it is not about a single field
+        uint64_t offset  = 0; // of the line start from the beginning of the input
+        int recordType   = -1;
+    };
+
+    // Counters and timings of the last load or save, collected only when
+    // the library is built with INTELHEX_STATS, all zero otherwise
+    struct Stats
+    {
+        uint64_t records       = 0; // parsed or written
+        uint64_t blocks        = 0; // in the image afterwards
+        uint64_t reallocations = 0; // block buffer growths
+        // Intel HEX phases, the checksum is summed while decoding and
+        // checked, with the line length and digits, in its own phase
+        std::chrono::nanoseconds decode {0};
+        std::chrono::nanoseconds checksum {0};
+        std::chrono::nanoseconds building {0}; // appending records to blocks
+        std::chrono::nanoseconds total {0};
+    };
+
+    // Heap held by an image, see memoryUsage()
+    struct MemoryUsage
+    {
+        uint64_t payload   = 0; // populated bytes
+        uint64_t allocated = 0; // block buffers including growth slack
+        uint64_t blocks    = 0;
+        uint64_t overhead  = 0; // block objects and the block table
+        uint64_t mapped    = 0; // payload read in place from a native file, not on the heap
     };
 
     IntelHex();
@@ -51,30 +167,148 @@ public:
     IntelHex &operator=(const IntelHex &hex);
     IntelHex &operator=(IntelHex &&hex);
 
-    Result load(fs::path path);
-    Result loads(const std::string &hex);
+    Result load(fs::path path, Format format = Format::AUTO);
+    Result loads(const std::string &hex, Format format = Format::AUTO);
+    // Raw image placed at baseAddress, sparse skips long runs of the fill char
+    Result loadBinary(const fs::path &path, uint32_t baseAddress = 0, bool sparse = false);
+    Result fromBinary(const uint8_t *data, size_t length, uint32_t baseAddress = 0, bool sparse = false);
     Result save();
-    Result save(const fs::path &path) const;
+    Result save(const fs::path &path, Format format = Format::AUTO) const;
+    // Flat image of [start, end), gaps are set to the fill char
+    void toBinary(uint32_t start, uint64_t end, uint8_t *out) const;
+    Result saveBinary(const fs::path &path) const;
+    Result saveBinary(const fs::path &path, uint32_t start, uint64_t end) const;
+    void toUf2(std::vector<uint8_t> &out) const;
     uint8_t get(uint32_t address) const;
     uint8_t &operator[](uint32_t address);
+    void write(uint32_t address, const uint8_t *data, uint32_t length);
     void erase(uint32_t address, uint32_t length);
     uint32_t maxAddress() const;
     uint32_t minAddress() const;
     uint32_t size() const;
+    MemoryUsage memoryUsage() const;
+    // Trims block buffers to their contents and drops empty blocks,
+    // worth calling on images that are kept around after loading
+    void shrinkToFit();
     Result state() const;
+    const Diagnostics &diagnostics() const;
+    const Stats &stats() const;
     void fill(uint8_t fillChar);
     bool isSet(uint32_t address, uint8_t &val) const;
     void setLineWidth(const uint8_t &lineWidth);
+    // Strict parsing (default) rejects non-hex chars and records longer than their length field
+    void setStrict(bool strict);
+    // Lenient parsing skips corrupted records instead of failing the load,
+    // the address ranges they claimed are reported by damagedRanges()
+    void setLenient(bool lenient);
+    const std::vector<Range> &damagedRanges() const;
+    // 0 omits the family ID from saved UF2 blocks
+    void setUf2FamilyId(uint32_t familyId);
+    uint32_t uf2FamilyId() const;
+    // CS:IP from a type 03 record, false if the image has none
+    bool startSegmentAddress(uint16_t &cs, uint16_t &ip) const;
+    void setStartSegmentAddress(uint16_t cs, uint16_t ip);
+    // EIP from a type 05 record or a non-zero S-record termination address, false if the
+    // last input had none. S-records written without one carry 0, so 0 does not survive them
+    bool startLinearAddress(uint32_t &address) const;
+    void setStartLinearAddress(uint32_t address);
+    void clearStartAddress();
+
+    // With compareFill unset bytes read as the fill char of their image,
+    // so padding that matches the other image's fill is not reported
+    static std::vector<Difference> diff(const IntelHex &first,
+                                        const IntelHex &second,
+                                        bool compareFill = false);
+    static Patch makePatch(const IntelHex &from, const IntelHex &to);
+    Result apply(const Patch &patch);
+    Result merge(const IntelHex &other, MergePolicy policy = MergePolicy::FAIL);
+    Result merge(const IntelHex &other, MergePolicy policy, std::vector<Range> &conflicts);
+
+    // Sidecar cache for load(): images loaded from a file are dumped into the
+    // directory and later loads of the unchanged file read the dump instead of
+    // parsing. Empty, the default, disables it.
+    void setCacheDirectory(const fs::path &directory);
+    const fs::path &cacheDirectory() const;
+    bool loadedFromCache() const;
+
+    // Loads every path on a pool of workers, 0 picks hardware concurrency
+    static BatchResult loadBatch(const std::vector<fs::path> &paths, unsigned workers = 0);
 
 private:
-    Result parse(std::istream &input);
+    // Line number and offset of the line being parsed, kept for diagnostics
+    struct LineCursor
+    {
+        uint32_t number = 0;
+        uint64_t offset = 0;
+        uint64_t next   = 0;
+        void advance(size_t size)
+        {
+            number++;
+            offset = next;
+            next += size + 1;
+        }
+    };
+
+    struct CacheKey;
+
+    void clear();
+    void fail(ParseError error, const LineCursor &cursor, uint32_t column, int recordType = -1);
+    bool skipDamaged(ParseError error,
+                     const LineCursor &cursor,
+                     uint32_t column,
+                     int recordType = -1,
+                     Range damaged  = {0, 0});
+    Result parse(std::istream &input, Format format);
+    Result parseIntelHex(std::istream &input);
+    Result parseSrec(std::istream &input);
+    Result parseTiTxt(std::istream &input);
+    Result parseElf(std::istream &input);
+    Result parseUf2(std::istream &input);
+    Result parseBinary(std::istream &input);
+    Result parseNative(std::istream &input);
+    Result loadNative(const fs::path &path);
+    Result saveNative(const fs::path &path) const;
+    Result readNative(uint8_t *data, size_t size, const std::shared_ptr<MappedFile> &mapping);
+    void writeNative(std::ostream &output) const;
+    static Format detectFormat(std::istream &input);
+    void saveIntelHex(std::ostream &output) const;
+    void saveSrec(std::ostream &output) const;
+    void saveTiTxt(std::ostream &output) const;
+    std::vector<Block *> sortedBlocks() const;
+    bool cacheKey(const fs::path &path, Format format, CacheKey &key) const;
+    bool readCache(const CacheKey &key);
+    void writeCache(const CacheKey &key) const;
 
     std::vector<Block *> m_blocks;
     mutable Block *m_cachedBlock = nullptr;
     mutable Result m_state = Result::INCORRECT_FILE;
     fs::path filename;
+    Diagnostics m_diagnostics;
+    mutable Stats m_stats;
     uint8_t m_fillChar  = 0xFF;
     uint8_t m_lineWidth = 0x10;
+    bool m_strict       = true;
+    bool m_lenient      = false;
+    std::vector<Range> m_damaged;
+    fs::path m_cacheDirectory;
+    bool m_loadedFromCache = false;
+    uint32_t m_uf2FamilyId = 0;
+    bool m_hasStartSegment = false;
+    uint16_t m_startCS     = 0;
+    uint16_t m_startIP     = 0;
+    bool m_hasStartLinear  = false;
+    uint32_t m_startEIP    = 0;
+};
+
+struct IntelHex::BatchResult
+{
+    // images and results are in the order of input paths
+    std::vector<IntelHex> images;
+    std::vector<Result> results;
+    unsigned workers = 0;
+    std::chrono::nanoseconds wallTime{0};
+    // sum of per-file load times across all workers
+    std::chrono::nanoseconds loadTime{0};
 };
 
 } // namespace IntelHexNS
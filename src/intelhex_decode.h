@@ -0,0 +1,171 @@
+/**
+ *  MIT License
+ *
+ *  Copyright (c) Dmitry Makarenko 2019
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#ifndef INTELHEX_DECODE_H
+#define INTELHEX_DECODE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Hex record decoding shared by the parsers and compile-time literals,
+// everything here is constexpr
+namespace IntelHexNS::Hex {
+
+// Nibble value of every char, HEX_INVALID flag is set for non-hex chars
+inline constexpr uint8_t HEX_INVALID = 0x10;
+inline constexpr std::array<uint8_t, 256> HEX_TABLE = [] {
+    std::array<uint8_t, 256> table {};
+    for (int c = 0; c < 256; c++) {
+        if (c >= '0' && c <= '9')
+            table[c] = c - '0';
+        else if (c >= 'A' && c <= 'F')
+            table[c] = c - 'A' + 10;
+        else if (c >= 'a' && c <= 'f')
+            table[c] = c - 'a' + 10;
+        else
+            table[c] = HEX_INVALID;
+    }
+    return table;
+}();
+
+// Record data is decoded through these, high digits come pre-shifted so a
+// pair is a single OR, PAIR_INVALID marks non-hex chars
+inline constexpr uint16_t PAIR_INVALID = 0x100;
+inline constexpr std::array<uint16_t, 256> PAIR_HIGH = [] {
+    std::array<uint16_t, 256> table {};
+    for (int c = 0; c < 256; c++) {
+        table[c] = HEX_TABLE[c] & HEX_INVALID ? PAIR_INVALID : HEX_TABLE[c] << 4;
+    }
+    return table;
+}();
+inline constexpr std::array<uint16_t, 256> PAIR_LOW = [] {
+    std::array<uint16_t, 256> table {};
+    for (int c = 0; c < 256; c++) {
+        table[c] = HEX_TABLE[c] & HEX_INVALID ? PAIR_INVALID : HEX_TABLE[c];
+    }
+    return table;
+}();
+
+constexpr uint8_t from_hex(char c)
+{
+    return HEX_TABLE[static_cast<uint8_t>(c)] & 0x0F;
+}
+
+constexpr bool isHexDigit(char c)
+{
+    return !(HEX_TABLE[static_cast<uint8_t>(c)] & HEX_INVALID);
+}
+
+// Decodes a hex pair, collecting the invalid flag of both chars
+constexpr uint8_t decodePair(const char *str, uint8_t &invalid)
+{
+    uint8_t hi = HEX_TABLE[static_cast<uint8_t>(str[0])];
+    uint8_t lo = HEX_TABLE[static_cast<uint8_t>(str[1])];
+    invalid |= hi | lo;
+    return (hi << 4) | (lo & 0x0F);
+}
+
+// Sums hex pairs in [begin, end), a trailing odd char is ignored
+constexpr uint8_t sumHexBytes(const char *begin, const char *end, uint8_t &invalid)
+{
+    uint8_t cs = 0;
+    for (const char *ptr = begin; ptr < end - 1; ptr += 2) {
+        cs += decodePair(ptr, invalid);
+    }
+    return cs;
+}
+
+// Decodes length bytes of record data into out and returns their sum.
+// Invalid chars are collected locally and folded into invalid once at the
+// end, writes through out could alias it and would force a reload per byte.
+constexpr uint8_t decodeData(const char *str, uint8_t *out, uint8_t length, uint8_t &invalid)
+{
+    uint16_t pairs = 0;
+    uint8_t sum    = 0;
+    for (int i = 0; i < length; i++) {
+        uint16_t pair = PAIR_HIGH[static_cast<uint8_t>(str[i * 2])] | PAIR_LOW[static_cast<uint8_t>(str[i * 2 + 1])];
+        pairs |= pair;
+        out[i] = static_cast<uint8_t>(pair);
+        sum += static_cast<uint8_t>(pair);
+    }
+    invalid |= pairs >> 4;
+    return sum;
+}
+
+// Same with the length known at compile time, so the loop is fully unrolled
+template<int LENGTH>
+constexpr uint8_t decodeFixed(const char *str, uint8_t *out, uint8_t &invalid)
+{
+    uint16_t pairs = 0;
+    uint8_t sum    = 0;
+    for (int i = 0; i < LENGTH; i++) {
+        uint16_t pair = PAIR_HIGH[static_cast<uint8_t>(str[i * 2])] | PAIR_LOW[static_cast<uint8_t>(str[i * 2 + 1])];
+        pairs |= pair;
+        out[i] = static_cast<uint8_t>(pair);
+        sum += static_cast<uint8_t>(pair);
+    }
+    invalid |= pairs >> 4;
+    return sum;
+}
+
+// Dispatches the usual 16, 32 and 64 byte records to their fixed width decode
+constexpr uint8_t decodePayload(const char *str, uint8_t *out, uint8_t length, uint8_t &invalid)
+{
+    switch (length) {
+    case 16:
+        return decodeFixed<16>(str, out, invalid);
+    case 32:
+        return decodeFixed<32>(str, out, invalid);
+    case 64:
+        return decodeFixed<64>(str, out, invalid);
+    default:
+        return decodeData(str, out, length, invalid);
+    }
+}
+
+// LLAAAATT fields of an Intel HEX record
+struct RecordHeader
+{
+    uint8_t length   = 0;
+    uint16_t address = 0;
+    uint8_t type     = 0;
+
+    // contribution of the header to the record checksum
+    constexpr uint8_t sum() const { return length + (address >> 8) + (address & 0xFF) + type; }
+};
+
+// str points just past the ':' start code and holds at least 8 chars
+constexpr RecordHeader decodeHeader(const char *str, uint8_t &invalid)
+{
+    RecordHeader header;
+    header.length  = decodePair(str, invalid);
+    header.address = (decodePair(str + 2, invalid) << 8) | decodePair(str + 4, invalid);
+    header.type    = decodePair(str + 6, invalid);
+    return header;
+}
+
+} // namespace IntelHexNS::Hex
+
+#endif // INTELHEX_DECODE_H
@@ -0,0 +1,169 @@
+/**
+ *  MIT License
+ *
+ *  Copyright (c) Dmitry Makarenko 2019
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#ifndef INTELHEX_LITERAL_H
+#define INTELHEX_LITERAL_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "intelhex.h"
+#include "intelhex_decode.h"
+
+namespace IntelHexNS {
+
+// Block table of an Intel HEX string literal, built by parseHexLiteral().
+// N is the size of the literal, which bounds the payload and block count.
+template<size_t N>
+struct HexLiteral
+{
+    struct Block
+    {
+        uint32_t address = 0;
+        uint32_t offset  = 0; // of the block's first byte in data
+        uint32_t length  = 0;
+    };
+
+    // a record is at least 12 chars with its newline and carries at most half of them
+    static constexpr size_t MAX_DATA   = N / 2;
+    static constexpr size_t MAX_BLOCKS = N / 12 + 1;
+
+    std::array<Block, MAX_BLOCKS> blocks {};
+    std::array<uint8_t, MAX_DATA> data {};
+    size_t blockCount = 0;
+    size_t size       = 0; // payload bytes in data
+
+    IntelHex::ParseError error = IntelHex::ParseError::NONE;
+    uint32_t line              = 0; // 1-based line of the error
+
+    // Writes the blocks into a new image
+    IntelHex image() const
+    {
+        IntelHex hex;
+        for (size_t i = 0; i < blockCount; i++) {
+            hex.write(blocks[i].address, &data[blocks[i].offset], blocks[i].length);
+        }
+        return hex;
+    }
+};
+
+// Not constexpr on purpose: reaching it while a literal is decoded at compile
+// time stops the build, the arguments show up in the compiler's message
+inline void malformedHexLiteral(IntelHex::ParseError, uint32_t) {}
+
+template<size_t N>
+constexpr HexLiteral<N> &failHexLiteral(HexLiteral<N> &literal, IntelHex::ParseError error, uint32_t line)
+{
+    literal.error = error;
+    literal.line  = line;
+    malformedHexLiteral(error, line);
+    return literal;
+}
+
+// Decodes an Intel HEX string literal with the same rules as strict loads().
+// Declared constexpr the result costs nothing at startup and a malformed
+// literal fails to compile, at runtime the error is left in the result:
+//
+//     constexpr auto boot = parseHexLiteral(":0100000042BD\n:00000001FF\n");
+//     static_assert(boot.size == 1);
+template<size_t N>
+constexpr HexLiteral<N> parseHexLiteral(const char (&text)[N])
+{
+    HexLiteral<N> literal;
+    // upper address bits from the last type 04 or type 02 record
+    uint32_t base  = 0;
+    uint32_t line  = 0;
+    size_t pos     = 0;
+    size_t textEnd = N > 0 && text[N - 1] == '\0' ? N - 1 : N;
+
+    while (pos < textEnd) {
+        size_t start = pos;
+        while (pos < textEnd && text[pos] != '\n')
+            pos++;
+        size_t stop = pos++;
+        line++;
+
+        // indentation and \r of raw string literals are fine
+        while (start < stop && (text[start] == ' ' || text[start] == '\t'))
+            start++;
+        while (stop > start && (text[stop - 1] == ' ' || text[stop - 1] == '\t' || text[stop - 1] == '\r'))
+            stop--;
+        if (start == stop)
+            continue;
+
+        if (text[start] != ':')
+            return failHexLiteral(literal, IntelHex::ParseError::BAD_START_CODE, line);
+        if (stop - start < 11)
+            return failHexLiteral(literal, IntelHex::ParseError::LENGTH_MISMATCH, line);
+
+        uint8_t invalid          = 0;
+        Hex::RecordHeader header = Hex::decodeHeader(&text[start + 1], invalid);
+        if (stop - start != 11 + header.length * 2u)
+            return failHexLiteral(literal, IntelHex::ParseError::LENGTH_MISMATCH, line);
+        uint8_t sum = Hex::sumHexBytes(&text[start + 1], &text[stop], invalid);
+        if (invalid & Hex::HEX_INVALID)
+            return failHexLiteral(literal, IntelHex::ParseError::BAD_HEX_DIGIT, line);
+        if (sum != 0)
+            return failHexLiteral(literal, IntelHex::ParseError::BAD_CHECKSUM, line);
+
+        const char *payload = &text[start + 9];
+        switch (header.type) {
+        case 0x00: {
+            uint32_t address = base + header.address;
+            auto *last       = literal.blockCount ? &literal.blocks[literal.blockCount - 1] : nullptr;
+            if (!last || last->address + last->length != address) {
+                last          = &literal.blocks[literal.blockCount++];
+                last->address = address;
+                last->offset  = uint32_t(literal.size);
+            }
+            Hex::decodePayload(payload, &literal.data[literal.size], header.length, invalid);
+            literal.size += header.length;
+            last->length += header.length;
+            break;
+        }
+        case 0x01:
+            return literal;
+        case 0x02:
+        case 0x04:
+            if (header.length != 2)
+                return failHexLiteral(literal, IntelHex::ParseError::BAD_RECORD, line);
+            base = Hex::decodePair(payload, invalid) << 8 | Hex::decodePair(payload + 2, invalid);
+            base <<= header.type == 0x04 ? 16 : 4;
+            break;
+        case 0x03:
+        case 0x05:
+            // start addresses are not part of the block table
+            if (header.length != 4)
+                return failHexLiteral(literal, IntelHex::ParseError::BAD_RECORD, line);
+            break;
+        default:
+            return failHexLiteral(literal, IntelHex::ParseError::BAD_RECORD_TYPE, line);
+        }
+    }
+    return failHexLiteral(literal, IntelHex::ParseError::MISSING_END, line);
+}
+
+} // namespace IntelHexNS
+
+#endif // INTELHEX_LITERAL_H
@@ -22,17 +22,42 @@
  *  SOFTWARE.
  */
 
+#include <fstream>
+#include <sstream>
 #include "catch.hpp"
+#include "corpus.h"
 #include "intelhex.h"
+#include "intelhex_literal.h"
 
 using namespace IntelHexNS;
 
+#ifdef TEST_ENABLE_FILE_OPS
+// 192K of firmware-like data in 12K chunks, crossing 64K pages
+static fs::path corpusFile()
+{
+    CorpusOptions options;
+    options.size  = 0x30000;
+    options.start = 0x9D000000;
+    options.chunk = 0x3000;
+    options.gap   = 0x1000;
+
+    auto path = fs::temp_directory_path() / "intelhex_corpus.hex";
+    std::ofstream file(path, std::ios::binary);
+    generateCorpus(options, file);
+    return path;
+}
+#endif
+
 TEST_CASE("Can load file", "Loading")
 {
     auto hex = IntelHex();
     REQUIRE(hex.load("??incorrect path??") == IntelHex::Result::FILE_NOT_FOUND);
 #ifdef TEST_ENABLE_FILE_OPS
-    REQUIRE(hex.load("c:/tmp/Main_project.hex") == IntelHex::Result::SUCCESS);
+    auto path = corpusFile();
+    REQUIRE(hex.load(path) == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.minAddress() == 0x9D000000);
+    REQUIRE(hex.maxAddress() == 0x9D03FFFF - 0x1000);
+    fs::remove(path);
 #endif
 }
 
@@ -52,35 +77,47 @@ TEST_CASE("Loads", "Loads")
 #ifdef TEST_ENABLE_FILE_OPS
 TEST_CASE("Can save file", "Saving")
 {
-    auto hex = IntelHex();
-    REQUIRE(hex.load("c:/tmp/Main_project.hex") == IntelHex::Result::SUCCESS);
-    REQUIRE(hex.save("c:/tmp/S2000R-DZ_V1-00_10-10-2018_11-56_out.hex") == IntelHex::Result::SUCCESS);
+    auto hex  = IntelHex();
+    auto path = corpusFile();
+    REQUIRE(hex.load(path) == IntelHex::Result::SUCCESS);
+    auto out = fs::temp_directory_path() / "intelhex_corpus_out.hex";
+    REQUIRE(hex.save(out) == IntelHex::Result::SUCCESS);
+
+    auto saved = IntelHex();
+    REQUIRE(saved.load(out) == IntelHex::Result::SUCCESS);
+    REQUIRE(IntelHex::diff(hex, saved).empty());
+    fs::remove(path);
+    fs::remove(out);
 }
 #endif
 
 #ifdef TEST_ENABLE_FILE_OPS
 TEST_CASE("Reading file", "Reading")
 {
-    auto hex = IntelHex();
-    REQUIRE(hex.load("c:/tmp/Main_project.hex") == IntelHex::Result::SUCCESS);
+    auto hex  = IntelHex();
+    auto path = corpusFile();
+    REQUIRE(hex.load(path) == IntelHex::Result::SUCCESS);
     volatile uint8_t byte;
-    for (uint32_t address = 0; address < 0x1FFFF; address++) {
+    for (uint32_t address = 0x9D000000; address < 0x9D01FFFF; address++) {
         byte = hex.get(address);
     }
+    fs::remove(path);
 }
 #endif
 
 #ifdef TEST_ENABLE_FILE_OPS
 TEST_CASE("Modifying file", "Modify")
 {
-    auto hex = IntelHex();
-    REQUIRE(hex.load("c:/tmp/Main_project.hex") == IntelHex::Result::SUCCESS);
+    auto hex  = IntelHex();
+    auto path = corpusFile();
+    REQUIRE(hex.load(path) == IntelHex::Result::SUCCESS);
     for (uint32_t address = 0x9d004000; address < 0x9d00a000; address++) {
         hex[address] = 0xFF;
     }
     for (uint32_t address = 0x9d004000; address < 0x9d00a000; address++) {
         REQUIRE(hex[address] == 0xFF);
     }
+    fs::remove(path);
 }
 #endif
 
@@ -147,3 +184,941 @@ TEST_CASE("Cutting of", "Erase")
     REQUIRE(hex.get(0x11f) == 0x19);
     REQUIRE(hex.get(0x12f) == 0xCA);
 }
+
+TEST_CASE("Diffing images", "Diff")
+{
+    auto input = R"(
+:10010000214601360121470136007EFE09D2190140
+:100110002146017E17C20001FF5F16002148011928
+:10012000194E79234623965778239EDA3F01B2CAA7
+:100130003F0156702B5E712B722B732146013421C7
+:00000001FF
+)";
+    auto golden = IntelHex();
+    REQUIRE(golden.loads(input) == IntelHex::Result::SUCCESS);
+    auto rebuilt = IntelHex(golden);
+    REQUIRE(IntelHex::diff(golden, rebuilt).empty());
+
+    rebuilt[0x105] = 0x00;
+    rebuilt[0x106] = 0x00;
+    rebuilt[0x140] = 0xFF;
+    rebuilt[0x141] = 0x12;
+    rebuilt.erase(0x130, 0x08);
+
+    auto diff = IntelHex::diff(golden, rebuilt);
+    REQUIRE(diff.size() == 3);
+    REQUIRE(diff[0].type == IntelHex::DiffType::CHANGED);
+    REQUIRE(diff[0].address == 0x105);
+    REQUIRE(diff[0].length == 2);
+    REQUIRE(diff[1].type == IntelHex::DiffType::REMOVED);
+    REQUIRE(diff[1].address == 0x130);
+    REQUIRE(diff[1].length == 8);
+    REQUIRE(diff[2].type == IntelHex::DiffType::ADDED);
+    REQUIRE(diff[2].address == 0x140);
+    REQUIRE(diff[2].length == 2);
+
+    // trailing 0xFF matches the golden image's fill
+    diff = IntelHex::diff(golden, rebuilt, true);
+    REQUIRE(diff.size() == 3);
+    REQUIRE(diff[2].type == IntelHex::DiffType::ADDED);
+    REQUIRE(diff[2].address == 0x141);
+    REQUIRE(diff[2].length == 1);
+
+    // the third record overwrites the start of the first one, leaving overlapping blocks
+    auto overlapping = IntelHex();
+    REQUIRE(overlapping.loads(R"(
+:10000000101112131415161718191A1B1C1D1E1F78
+:08002000AAAAAAAAAAAAAAAA88
+:08000000555555555555555550
+:00000001FF
+)") == IntelHex::Result::SUCCESS);
+    for (bool compareFill : {false, true}) {
+        diff = IntelHex::diff(overlapping, IntelHex(), compareFill);
+        REQUIRE(diff.size() == 2);
+        REQUIRE(diff[0].type == IntelHex::DiffType::REMOVED);
+        REQUIRE(diff[0].address == 0x00);
+        REQUIRE(diff[0].length == 0x10);
+        REQUIRE(diff[1].address == 0x20);
+        REQUIRE(diff[1].length == 0x08);
+    }
+}
+
+TEST_CASE("Patching images", "Patch")
+{
+    auto input = R"(
+:10010000214601360121470136007EFE09D2190140
+:100110002146017E17C20001FF5F16002148011928
+:10012000194E79234623965778239EDA3F01B2CAA7
+:100130003F0156702B5E712B722B732146013421C7
+:00000001FF
+)";
+    auto from = IntelHex();
+    REQUIRE(from.loads(input) == IntelHex::Result::SUCCESS);
+    auto to = IntelHex(from);
+    to[0x105] = 0x00;
+    to.erase(0x120, 0x10);
+    uint8_t page[] = {1, 2, 3, 4};
+    to.write(0x1FFFE, page, sizeof(page));
+
+    IntelHex::Patch patch;
+    REQUIRE(IntelHex::Patch::deserialize(IntelHex::makePatch(from, to).serialize(), patch) ==
+            IntelHex::Result::SUCCESS);
+    REQUIRE(patch.records.size() == 3);
+    REQUIRE(from.apply(patch) == IntelHex::Result::SUCCESS);
+    REQUIRE(IntelHex::diff(from, to).empty());
+    REQUIRE(from.get(0x20001) == 4);
+
+    uint8_t val;
+    REQUIRE_FALSE(from.isSet(0x125, val));
+    REQUIRE_FALSE(IntelHex::Patch::deserialize({'I', 'H', 'X', 'P'}, patch) ==
+                  IntelHex::Result::SUCCESS);
+
+    // scattered edits across several blocks, applied in one pass
+    uint8_t data[0x400];
+    for (uint32_t i = 0; i < sizeof(data); i++) {
+        data[i] = i;
+    }
+    from = IntelHex();
+    from.write(0x1000, data, sizeof(data));
+    from.write(0x1800, data, sizeof(data));
+    to = IntelHex(from);
+    for (uint32_t address = 0x1000; address < 0x2000; address += 0x21) {
+        to[address] = 0xEE;
+    }
+    to.erase(0x1100, 0x10);
+    to.erase(0x13F0, 0x20);
+    to.write(0x1400, data, 0x10);
+    to.erase(0x1C00, 0x400);
+    patch = IntelHex::makePatch(from, to);
+    REQUIRE(patch.records.size() > 50);
+    REQUIRE(from.apply(patch) == IntelHex::Result::SUCCESS);
+    REQUIRE(IntelHex::diff(from, to).empty());
+    REQUIRE(IntelHex::diff(to, from).empty());
+}
+
+#ifdef TEST_ENABLE_FILE_OPS
+TEST_CASE("Saving blocks across 64K pages", "Saving")
+{
+    auto hex = IntelHex();
+    uint8_t data[0x40];
+    for (uint32_t i = 0; i < sizeof(data); i++) {
+        data[i] = i;
+    }
+    hex.write(0x1FFE0, data, sizeof(data));
+    auto path = fs::temp_directory_path() / "intelhex_pages.hex";
+    REQUIRE(hex.save(path) == IntelHex::Result::SUCCESS);
+
+    auto loaded = IntelHex();
+    REQUIRE(loaded.load(path) == IntelHex::Result::SUCCESS);
+    REQUIRE(IntelHex::diff(hex, loaded).empty());
+    fs::remove(path);
+}
+
+TEST_CASE("Saving the widest records", "Saving")
+{
+    auto hex = IntelHex();
+    uint8_t data[0x300];
+    for (uint32_t i = 0; i < sizeof(data); i++) {
+        data[i] = i;
+    }
+    hex.write(0xFF80, data, sizeof(data));
+    hex.setLineWidth(255);
+    auto path = fs::temp_directory_path() / "intelhex_wide.hex";
+    for (auto format : {IntelHex::Format::INTEL_HEX, IntelHex::Format::SREC}) {
+        REQUIRE(hex.save(path, format) == IntelHex::Result::SUCCESS);
+        auto loaded = IntelHex();
+        REQUIRE(loaded.load(path) == IntelHex::Result::SUCCESS);
+        REQUIRE(IntelHex::diff(hex, loaded).empty());
+    }
+    fs::remove(path);
+}
+#endif
+
+TEST_CASE("Merging images", "Merge")
+{
+    auto bootloader = IntelHex();
+    REQUIRE(bootloader.loads(R"(
+:10010000214601360121470136007EFE09D2190140
+:100110002146017E17C20001FF5F16002148011928
+:00000001FF
+)") == IntelHex::Result::SUCCESS);
+    auto application = IntelHex();
+    REQUIRE(application.loads(R"(
+:100110002146017E17C20001FF5F16002148011928
+:10012000194E79234623965778239EDA3F01B2CAA7
+:00000001FF
+)") == IntelHex::Result::SUCCESS);
+
+    // identical overlapping bytes are not a conflict
+    auto image = IntelHex(bootloader);
+    REQUIRE(image.merge(application) == IntelHex::Result::SUCCESS);
+    REQUIRE(image.get(0x100) == 0x21);
+    REQUIRE(image.get(0x12F) == 0xCA);
+
+    application[0x115] = 0x00;
+    std::vector<IntelHex::Range> conflicts;
+    image = bootloader;
+    REQUIRE(image.merge(application, IntelHex::MergePolicy::FAIL, conflicts) ==
+            IntelHex::Result::CONFLICT);
+    REQUIRE(conflicts.size() == 1);
+    REQUIRE(conflicts[0].address == 0x115);
+    REQUIRE(conflicts[0].length == 1);
+    REQUIRE(IntelHex::diff(image, bootloader).empty());
+
+    REQUIRE(image.merge(application, IntelHex::MergePolicy::KEEP_FIRST) ==
+            IntelHex::Result::SUCCESS);
+    REQUIRE(image.get(0x115) == 0xC2);
+    REQUIRE(image.get(0x120) == 0x19);
+
+    REQUIRE(image.merge(application, IntelHex::MergePolicy::OVERWRITE) ==
+            IntelHex::Result::SUCCESS);
+    REQUIRE(image.get(0x115) == 0x00);
+
+    // bytes inside, between and after the existing blocks
+    auto scattered = IntelHex();
+    for (uint32_t address = 0xF0; address < 0x200; address += 0x07) {
+        scattered[address] = 0xEE;
+    }
+    auto merged = IntelHex(image);
+    REQUIRE(merged.merge(scattered, IntelHex::MergePolicy::OVERWRITE) == IntelHex::Result::SUCCESS);
+    for (uint32_t address = 0xF0; address < 0x200; address++) {
+        uint8_t expected, val;
+        bool populated = scattered.isSet(address, expected) || image.isSet(address, expected);
+        REQUIRE(merged.isSet(address, val) == populated);
+        REQUIRE(val == expected);
+    }
+
+    // merging an image with empty blocks into itself changes nothing
+    auto self = IntelHex();
+    REQUIRE(self.loads(":0100000042BD\n:00000001FF\n") == IntelHex::Result::SUCCESS);
+    REQUIRE(self.loads(":00000001FF\n") == IntelHex::Result::SUCCESS);
+    REQUIRE(self.merge(self) == IntelHex::Result::SUCCESS);
+    REQUIRE(self.get(0) == 0x42);
+}
+
+#ifdef TEST_ENABLE_FILE_OPS
+TEST_CASE("Loading files in batch", "Loading")
+{
+    auto hex   = IntelHex();
+    auto input = R"(
+:10010000214601360121470136007EFE09D2190140
+:00000001FF
+)";
+    REQUIRE(hex.loads(input) == IntelHex::Result::SUCCESS);
+
+    std::vector<fs::path> paths;
+    for (int i = 0; i < 8; i++) {
+        hex[0x200] = i;
+        paths.push_back(fs::temp_directory_path() / ("intelhex_batch_" + std::to_string(i) + ".hex"));
+        REQUIRE(hex.save(paths.back()) == IntelHex::Result::SUCCESS);
+    }
+    paths.insert(paths.begin() + 3, "??incorrect path??");
+
+    auto batch = IntelHex::loadBatch(paths, 3);
+    REQUIRE(batch.workers == 3);
+    REQUIRE(batch.images.size() == paths.size());
+    REQUIRE(batch.results[3] == IntelHex::Result::FILE_NOT_FOUND);
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (i == 3)
+            continue;
+        REQUIRE(batch.results[i] == IntelHex::Result::SUCCESS);
+        REQUIRE(batch.images[i].get(0x200) == (i < 3 ? i : i - 1));
+        REQUIRE(batch.images[i].get(0x100) == 0x21);
+        fs::remove(paths[i]);
+    }
+    REQUIRE(batch.wallTime.count() > 0);
+}
+#endif
+
+TEST_CASE("Exporting flat binary", "Binary")
+{
+    auto hex   = IntelHex();
+    auto input = R"(
+:10010000214601360121470136007EFE09D2190140
+:100130003F0156702B5E712B722B732146013421C7
+:00000001FF
+)";
+    REQUIRE(hex.loads(input) == IntelHex::Result::SUCCESS);
+    hex.fill(0xAA);
+
+    std::vector<uint8_t> bin(0x40);
+    hex.toBinary(0xF8, 0x138, bin.data());
+    for (uint32_t i = 0; i < bin.size(); i++) {
+        REQUIRE(bin[i] == hex.get(0xF8 + i));
+    }
+    REQUIRE(bin[0] == 0xAA);
+    REQUIRE(bin[0x08] == 0x21);
+    REQUIRE(bin[0x20] == 0xAA);
+    REQUIRE(bin[0x38] == 0x3F);
+
+#ifdef TEST_ENABLE_FILE_OPS
+    auto path = fs::temp_directory_path() / "intelhex_flat.bin";
+    REQUIRE(hex.saveBinary(path) == IntelHex::Result::SUCCESS);
+    REQUIRE(fs::file_size(path) == 0x40);
+
+    // the empty block left by the end of file record does not stretch the range
+    hex = IntelHex();
+    REQUIRE(hex.loads(":00000001FF\n") == IntelHex::Result::SUCCESS);
+    uint8_t data[] = {1, 2, 3, 4};
+    hex.write(0x1000, data, sizeof(data));
+    REQUIRE(hex.saveBinary(path) == IntelHex::Result::SUCCESS);
+    REQUIRE(fs::file_size(path) == sizeof(data));
+    fs::remove(path);
+#endif
+}
+
+TEST_CASE("Importing flat binary", "Binary")
+{
+    std::vector<uint8_t> bin(0x100, 0xFF);
+    for (uint32_t i = 0; i < 0x10; i++) {
+        bin[i]        = i;
+        bin[0xF0 + i] = 0xF0 + i;
+    }
+
+    auto hex = IntelHex();
+    REQUIRE(hex.fromBinary(bin.data(), bin.size(), 0x8000) == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.minAddress() == 0x8000);
+    REQUIRE(hex.maxAddress() == 0x80FF);
+    uint8_t val;
+    REQUIRE(hex.isSet(0x8080, val));
+
+    REQUIRE(hex.fromBinary(bin.data(), bin.size(), 0x8000, true) == IntelHex::Result::SUCCESS);
+    REQUIRE_FALSE(hex.isSet(0x8080, val));
+    REQUIRE(hex.get(0x800F) == 0x0F);
+    REQUIRE(hex.get(0x80F0) == 0xF0);
+
+    REQUIRE(hex.fromBinary(bin.data(), bin.size(), 0xFFFFFF00) == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.fromBinary(bin.data(), bin.size(), 0xFFFFFF01) ==
+            IntelHex::Result::UNSUPPORTED_FORMAT);
+
+#ifdef TEST_ENABLE_FILE_OPS
+    REQUIRE(hex.fromBinary(bin.data(), bin.size(), 0x8000, true) == IntelHex::Result::SUCCESS);
+    auto path = fs::temp_directory_path() / "intelhex_import.bin";
+    REQUIRE(hex.saveBinary(path) == IntelHex::Result::SUCCESS);
+    auto loaded = IntelHex();
+    REQUIRE(loaded.loadBinary(path, 0x8000) == IntelHex::Result::SUCCESS);
+    REQUIRE(IntelHex::diff(hex, loaded, true).empty());
+    REQUIRE(loaded.isSet(0x8080, val));
+    fs::remove(path);
+#endif
+}
+
+TEST_CASE("Loading S-records", "Srec")
+{
+    auto hex   = IntelHex();
+    auto input = R"(
+S00F000068656C6C6F202020202000003C
+S11F00007C0802A6900100049421FFF07C6C1B787C8C23783C6000003863000026
+S11F001C4BFFFFE5398000007D83637880010014382100107C0803A64E800020E9
+S111003848656C6C6F20776F726C642E0A0042
+S5030003F9
+S9030000FC
+)";
+    REQUIRE(hex.loads(input, IntelHex::Format::SREC) == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.minAddress() == 0x0000);
+    REQUIRE(hex.maxAddress() == 0x0045);
+    REQUIRE(hex.get(0x0000) == 0x7C);
+    REQUIRE(hex.get(0x0038) == 0x48);
+
+    auto broken = IntelHex();
+    REQUIRE(broken.loads("S111003848656C6C6F20776F726C642E0A0043\n", IntelHex::Format::SREC) ==
+            IntelHex::Result::INCORRECT_FILE);
+    // data running past the 32 bit address space does not wrap around to 0
+    broken = IntelHex();
+    REQUIRE(broken.loads("S309FFFFFFFE01020304F1\nS70500000000FA\n", IntelHex::Format::SREC) ==
+            IntelHex::Result::INCORRECT_FILE);
+    REQUIRE(broken.diagnostics().error == IntelHex::ParseError::BAD_RECORD);
+
+#ifdef TEST_ENABLE_FILE_OPS
+    hex[0x123456] = 0x42;
+    auto path     = fs::temp_directory_path() / "intelhex_srec.s28";
+    REQUIRE(hex.save(path, IntelHex::Format::SREC) == IntelHex::Result::SUCCESS);
+    auto loaded = IntelHex();
+    REQUIRE(loaded.load(path, IntelHex::Format::SREC) == IntelHex::Result::SUCCESS);
+    REQUIRE(IntelHex::diff(hex, loaded).empty());
+    fs::remove(path);
+#endif
+}
+
+TEST_CASE("Detecting format", "Loads")
+{
+    auto hex = IntelHex();
+    REQUIRE(hex.loads("\r\nS11F00007C0802A6900100049421FFF07C6C1B787C8C23783C6000003863000026\n") ==
+            IntelHex::Result::SUCCESS);
+    REQUIRE(hex.get(0x0000) == 0x7C);
+
+    hex = IntelHex();
+    REQUIRE(hex.loads(":0100100001EE\n:00000001FF\n") == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.get(0x0010) == 0x01);
+
+    hex = IntelHex();
+    REQUIRE(hex.loads(std::string("\n\x01\x02\x03\0\x05\x06", 7)) == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.minAddress() == 0);
+    REQUIRE(hex.maxAddress() == 6);
+    REQUIRE(hex.get(0x0000) == '\n');
+    REQUIRE(hex.get(0x0004) == 0x00);
+
+    // plain text is not taken for a raw image
+    hex = IntelHex();
+    REQUIRE(hex.loads("hello world\n") == IntelHex::Result::INCORRECT_FILE);
+    REQUIRE(hex.diagnostics().error == IntelHex::ParseError::BAD_START_CODE);
+
+    // nor is a hex file whose first line lost its start code
+    auto damaged = "10010000214601360121470136007EFE09D2190140\n"
+                   ":100110002146017E17C20001FF5F16002148011928\n"
+                   ":00000001FF\n";
+    hex = IntelHex();
+    REQUIRE(hex.loads(damaged) == IntelHex::Result::INCORRECT_FILE);
+    REQUIRE(hex.diagnostics().error == IntelHex::ParseError::BAD_START_CODE);
+    REQUIRE(hex.diagnostics().line == 1);
+    hex = IntelHex();
+    hex.setLenient(true);
+    REQUIRE(hex.loads(damaged) == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.minAddress() == 0x110);
+    REQUIRE(hex.get(0x110) == 0x21);
+}
+
+TEST_CASE("Loading TI-TXT", "TiTxt")
+{
+    auto hex   = IntelHex();
+    auto input = R"(@F000
+31 40 00 03 B2 40 80 5A 20 01 D2 D3 22 00 D2 E3
+21 00 3F 40 E8 FD 1F 83 FE 23 F9 3F
+@FFFE
+00 F0
+q
+)";
+    REQUIRE(hex.loads(input) == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.minAddress() == 0xF000);
+    REQUIRE(hex.maxAddress() == 0xFFFF);
+    REQUIRE(hex.get(0xF010) == 0x21);
+    REQUIRE(hex.get(0xF01B) == 0x3F);
+    REQUIRE(hex.get(0xFFFF) == 0xF0);
+    uint8_t val;
+    REQUIRE_FALSE(hex.isSet(0xF01C, val));
+
+    auto broken = IntelHex();
+    REQUIRE(broken.loads("@F000\n31 4\nq\n", IntelHex::Format::TI_TXT) == IntelHex::Result::INCORRECT_FILE);
+    broken = IntelHex();
+    REQUIRE(broken.loads("@F000\n31 40\n", IntelHex::Format::TI_TXT) == IntelHex::Result::INCORRECT_FILE);
+    // data running past the 32 bit address space does not wrap around to 0
+    broken = IntelHex();
+    REQUIRE(broken.loads("@FFFFFFFE\n31 40 00 03\nq\n") == IntelHex::Result::INCORRECT_FILE);
+    REQUIRE(broken.diagnostics().error == IntelHex::ParseError::BAD_RECORD);
+    REQUIRE(broken.loads("@FFFFFFFE\n31 40\n00 03\nq\n") == IntelHex::Result::INCORRECT_FILE);
+
+#ifdef TEST_ENABLE_FILE_OPS
+    hex[0x12345] = 0x42;
+    auto path    = fs::temp_directory_path() / "intelhex_ti.txt";
+    REQUIRE(hex.save(path, IntelHex::Format::TI_TXT) == IntelHex::Result::SUCCESS);
+    auto loaded = IntelHex();
+    REQUIRE(loaded.load(path) == IntelHex::Result::SUCCESS);
+    REQUIRE(IntelHex::diff(hex, loaded).empty());
+    fs::remove(path);
+#endif
+}
+
+// Minimal ELF with a single PT_LOAD segment of given payload
+static std::string makeElf(bool is64, bool bigEndian, uint64_t paddr, const std::string &payload)
+{
+    size_t headerSize = is64 ? 0x40 : 0x34;
+    size_t entrySize  = is64 ? 0x38 : 0x20;
+    std::string elf(headerSize + entrySize, '\0');
+    auto put = [&](size_t offset, uint64_t value, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            elf[bigEndian ? offset + size - 1 - i : offset + i] = char(value >> (i * 8));
+        }
+    };
+    elf.replace(0, 4, "\x7F" "ELF");
+    elf[4] = is64 ? 2 : 1;
+    elf[5] = bigEndian ? 2 : 1;
+    elf[6] = 1;
+    put(is64 ? 0x20 : 0x1C, headerSize, is64 ? 8 : 4);
+    put(is64 ? 0x36 : 0x2A, entrySize, 2);
+    put(is64 ? 0x38 : 0x2C, 1, 2);
+    put(headerSize, 1, 4);
+    put(headerSize + (is64 ? 0x08 : 0x04), elf.size(), is64 ? 8 : 4);
+    put(headerSize + (is64 ? 0x10 : 0x08), paddr + 0x20000000, is64 ? 8 : 4);
+    put(headerSize + (is64 ? 0x18 : 0x0C), paddr, is64 ? 8 : 4);
+    put(headerSize + (is64 ? 0x20 : 0x10), payload.size(), is64 ? 8 : 4);
+    put(headerSize + (is64 ? 0x28 : 0x14), payload.size() + 0x100, is64 ? 8 : 4);
+    return elf + payload;
+}
+
+TEST_CASE("Loading ELF segments", "Elf")
+{
+    auto hex = IntelHex();
+    REQUIRE(hex.loads(makeElf(false, false, 0x08000000, "\x01\x02\x03\x04")) == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.minAddress() == 0x08000000);
+    REQUIRE(hex.maxAddress() == 0x08000003);
+    REQUIRE(hex.get(0x08000002) == 0x03);
+
+    hex = IntelHex();
+    REQUIRE(hex.loads(makeElf(true, true, 0x1000, "\xAA\xBB")) == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.minAddress() == 0x1000);
+    REQUIRE(hex.get(0x1001) == 0xBB);
+
+    hex = IntelHex();
+    REQUIRE(hex.loads(makeElf(true, false, 0x100000000ULL, "\xAA")) == IntelHex::Result::UNSUPPORTED_FORMAT);
+    REQUIRE(hex.loads(makeElf(true, false, 0xFFFFFFFFFFFFFFF0ULL, std::string(0x20, '\x55'))) ==
+            IntelHex::Result::UNSUPPORTED_FORMAT);
+    auto truncated = makeElf(false, false, 0, "\x01\x02\x03\x04");
+    truncated.resize(truncated.size() - 1);
+    REQUIRE(hex.loads(truncated, IntelHex::Format::ELF) == IntelHex::Result::INCORRECT_FILE);
+
+#ifdef TEST_ENABLE_FILE_OPS
+    // ELF is load only, an existing file is left as it is
+    auto elf  = makeElf(false, false, 0x08000000, "\x01\x02\x03\x04");
+    auto path = fs::temp_directory_path() / "intelhex_segments.elf";
+    std::ofstream(path, std::ios::binary) << elf;
+    REQUIRE(hex.save(path, IntelHex::Format::ELF) == IntelHex::Result::UNSUPPORTED_FORMAT);
+    REQUIRE(fs::file_size(path) == elf.size());
+    fs::remove(path);
+#endif
+}
+
+TEST_CASE("Converting to UF2", "Uf2")
+{
+    auto hex   = IntelHex();
+    auto input = R"(
+:10010000214601360121470136007EFE09D2190140
+:100130003F0156702B5E712B722B732146013421C7
+:020000040001F9
+:0100000042BD
+:00000001FF
+)";
+    REQUIRE(hex.loads(input) == IntelHex::Result::SUCCESS);
+    hex.setUf2FamilyId(0xE48BFF56);
+
+    std::vector<uint8_t> uf2;
+    hex.toUf2(uf2);
+    REQUIRE(uf2.size() == 2 * 512);
+    REQUIRE(uf2[12 + 1] == 0x01);
+    REQUIRE(uf2[32] == 0x21);
+    REQUIRE(uf2[32 + 0x10] == 0xFF);
+    REQUIRE(uf2[512 + 12 + 2] == 0x01);
+
+    auto loaded = IntelHex();
+    REQUIRE(loaded.loads(std::string(uf2.begin(), uf2.end())) == IntelHex::Result::SUCCESS);
+    REQUIRE(loaded.uf2FamilyId() == 0xE48BFF56);
+    REQUIRE(IntelHex::diff(hex, loaded, true).empty());
+    REQUIRE(loaded.get(0x10000) == 0x42);
+
+    uf2.pop_back();
+    REQUIRE(loaded.loads(std::string(uf2.begin(), uf2.end()), IntelHex::Format::UF2) ==
+            IntelHex::Result::INCORRECT_FILE);
+}
+
+TEST_CASE("Segment addressing", "Loads")
+{
+    auto hex   = IntelHex();
+    auto input = R"(
+:020000021000EC
+:0400000001020304F2
+:0400000312345678E5
+:00000001FF
+)";
+    REQUIRE(hex.loads(input) == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.minAddress() == 0x10000);
+    REQUIRE(hex.get(0x10003) == 0x04);
+
+    uint16_t cs, ip;
+    REQUIRE(hex.startSegmentAddress(cs, ip));
+    REQUIRE(cs == 0x1234);
+    REQUIRE(ip == 0x5678);
+
+    auto other = IntelHex();
+    REQUIRE(other.loads(":0100000042BD\n:00000001FF\n") == IntelHex::Result::SUCCESS);
+    REQUIRE_FALSE(other.startSegmentAddress(cs, ip));
+
+    // nor does a later input without one inherit it
+    REQUIRE(hex.loads(":0100000042BD\n:00000001FF\n") == IntelHex::Result::SUCCESS);
+    REQUIRE_FALSE(hex.startSegmentAddress(cs, ip));
+}
+
+#ifdef TEST_ENABLE_FILE_OPS
+TEST_CASE("Saving start addresses", "Saving")
+{
+    auto hex   = IntelHex();
+    auto input = R"(
+:0100000042BD
+:0400000508000131BD
+:00000001FF
+)";
+    REQUIRE(hex.loads(input) == IntelHex::Result::SUCCESS);
+    uint32_t eip;
+    REQUIRE(hex.startLinearAddress(eip));
+    REQUIRE(eip == 0x08000131);
+    hex.setStartSegmentAddress(0x1234, 0x5678);
+
+    auto path = fs::temp_directory_path() / "intelhex_start.hex";
+    REQUIRE(hex.save(path) == IntelHex::Result::SUCCESS);
+    auto loaded = IntelHex();
+    REQUIRE(loaded.load(path) == IntelHex::Result::SUCCESS);
+    uint16_t cs, ip;
+    REQUIRE(loaded.startSegmentAddress(cs, ip));
+    REQUIRE(cs == 0x1234);
+    REQUIRE(ip == 0x5678);
+    REQUIRE(loaded.startLinearAddress(eip));
+    REQUIRE(eip == 0x08000131);
+
+    // an image without entry point keeps none through S-records
+    loaded.clearStartAddress();
+    REQUIRE(loaded.save(path, IntelHex::Format::SREC) == IntelHex::Result::SUCCESS);
+    REQUIRE(loaded.load(path) == IntelHex::Result::SUCCESS);
+    REQUIRE_FALSE(loaded.startLinearAddress(eip));
+    REQUIRE(loaded.save(path) == IntelHex::Result::SUCCESS);
+    std::ifstream saved(path);
+    std::string text((std::istreambuf_iterator<char>(saved)), std::istreambuf_iterator<char>());
+    REQUIRE(text.find(":04000005") == std::string::npos);
+    hex.clearStartAddress();
+    hex.setStartLinearAddress(0x08000131);
+    REQUIRE(hex.save(path, IntelHex::Format::SREC) == IntelHex::Result::SUCCESS);
+    REQUIRE(loaded.load(path) == IntelHex::Result::SUCCESS);
+    REQUIRE(loaded.startLinearAddress(eip));
+    REQUIRE(eip == 0x08000131);
+    fs::remove(path);
+}
+#endif
+
+TEST_CASE("Reporting parse errors", "Loads")
+{
+    auto hex = IntelHex();
+    REQUIRE(hex.loads(":0100000042BD\n:00000001FF\n") == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.diagnostics().error == IntelHex::ParseError::NONE);
+
+    hex = IntelHex();
+    REQUIRE(hex.loads(":0100000042BD\n:10010000214601360121470136007EFE09D2190141\n:00000001FF\n") ==
+            IntelHex::Result::INCORRECT_FILE);
+    REQUIRE(hex.diagnostics().error == IntelHex::ParseError::BAD_CHECKSUM);
+    REQUIRE(hex.diagnostics().line == 2);
+    REQUIRE(hex.diagnostics().column == 42);
+    REQUIRE(hex.diagnostics().offset == 14);
+    REQUIRE(hex.diagnostics().recordType == 0);
+
+    hex = IntelHex();
+    REQUIRE(hex.loads(":10010000214601360121470136007EFE09D2\n", IntelHex::Format::INTEL_HEX) ==
+            IntelHex::Result::INCORRECT_FILE);
+    REQUIRE(hex.diagnostics().error == IntelHex::ParseError::LENGTH_MISMATCH);
+
+    hex = IntelHex();
+    REQUIRE(hex.loads(":0100000042BD\n") == IntelHex::Result::INCORRECT_FILE);
+    REQUIRE(hex.diagnostics().error == IntelHex::ParseError::MISSING_END);
+
+    hex = IntelHex();
+    REQUIRE(hex.loads("@F000\n31 4X\nq\n") == IntelHex::Result::INCORRECT_FILE);
+    REQUIRE(hex.diagnostics().error == IntelHex::ParseError::BAD_HEX_DIGIT);
+    REQUIRE(hex.diagnostics().line == 2);
+    REQUIRE(hex.diagnostics().column == 4);
+}
+
+TEST_CASE("Validating hex characters", "Loads")
+{
+    auto input = ":10010000214601360121470136007EFE09D2190140\n"
+                 ":10011000214601G17E17C20001FF5F16002148011928\n"
+                 ":00000001FF\n";
+    auto hex = IntelHex();
+    REQUIRE(hex.loads(input) == IntelHex::Result::INCORRECT_FILE);
+    REQUIRE(hex.diagnostics().error == IntelHex::ParseError::LENGTH_MISMATCH);
+
+    // same length as a valid record, checksum is correct once G reads as 0
+    hex = IntelHex();
+    REQUIRE(hex.loads(":0100000G42BD\n:00000001FF\n") == IntelHex::Result::INCORRECT_FILE);
+    REQUIRE(hex.diagnostics().error == IntelHex::ParseError::BAD_HEX_DIGIT);
+    REQUIRE(hex.diagnostics().column == 9);
+
+    hex = IntelHex();
+    hex.setStrict(false);
+    REQUIRE(hex.loads(":0100000G42BD\n:00000001FF\n") == IntelHex::Result::SUCCESS);
+
+    hex = IntelHex();
+    REQUIRE(hex.loads(":0100000042BD  \r\n:00000001FF\r\n") == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.get(0) == 0x42);
+}
+
+TEST_CASE("Recovering damaged records", "Loads")
+{
+    // second and third records have broken checksums, fourth lost its start code
+    auto input = ":10010000214601360121470136007EFE09D2190140\n"
+                 ":100110002146017E17C20001FF5F16002148011927\n"
+                 ":10012000194E79234623965778239EDA3F01B2CA3E\n"
+                 "10013000F8CFF8C1\n"
+                 ":04014000214601361D\n";
+    auto hex = IntelHex();
+    REQUIRE(hex.loads(input) == IntelHex::Result::INCORRECT_FILE);
+    REQUIRE(hex.damagedRanges().empty());
+
+    hex = IntelHex();
+    hex.setLenient(true);
+    REQUIRE(hex.loads(input) == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.diagnostics().error == IntelHex::ParseError::BAD_CHECKSUM);
+    REQUIRE(hex.diagnostics().line == 2);
+    REQUIRE(hex.damagedRanges().size() == 1);
+    REQUIRE(hex.damagedRanges()[0].address == 0x0110);
+    REQUIRE(hex.damagedRanges()[0].length == 0x20);
+
+    // partial data before and after the damage is kept
+    uint8_t value;
+    REQUIRE(hex.get(0x0100) == 0x21);
+    REQUIRE_FALSE(hex.isSet(0x0110, value));
+    REQUIRE(hex.isSet(0x0143, value));
+    REQUIRE(value == 0x36);
+}
+
+TEST_CASE("Generating corpus", "Corpus")
+{
+    CorpusOptions options;
+    options.size          = 0x8000;
+    options.lineWidth     = 32;
+    options.extendedEvery = 8;
+    std::ostringstream first, second;
+    auto stats = generateCorpus(options, first);
+    generateCorpus(options, second);
+    REQUIRE(first.str() == second.str());
+    REQUIRE(stats.payload == 0x8000);
+    REQUIRE(stats.extended == 0x8000 / 32 / 8);
+
+    auto hex = IntelHex();
+    REQUIRE(hex.loads(first.str()) == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.minAddress() == 0);
+    REQUIRE(hex.maxAddress() == 0x7FFF);
+
+    options.errorRate = 0.05;
+    std::ostringstream damaged;
+    stats = generateCorpus(options, damaged);
+    REQUIRE(stats.corrupted > 0);
+    REQUIRE(hex.loads(damaged.str()) == IntelHex::Result::INCORRECT_FILE);
+
+    // every corrupted record is skipped, the ones with a start code are reported
+    hex = IntelHex();
+    hex.setLenient(true);
+    REQUIRE(hex.loads(damaged.str()) == IntelHex::Result::SUCCESS);
+    uint32_t populated = 0;
+    for (uint32_t address = 0; address < 0x8000; address++) {
+        uint8_t val;
+        populated += hex.isSet(address, val);
+    }
+    REQUIRE(populated == 0x8000 - stats.corrupted * 32);
+    uint64_t lost = 0;
+    for (const auto &range : hex.damagedRanges()) {
+        lost += range.length;
+    }
+    REQUIRE(lost > 0);
+    REQUIRE(lost <= stats.corrupted * 32);
+}
+
+TEST_CASE("Collecting statistics", "Stats")
+{
+    auto hex   = IntelHex();
+    auto input = R"(
+:10010000214601360121470136007EFE09D2190140
+:100110002146017E17C20001FF5F16002148011928
+:10012000194E79234623965778239EDA3F01B2CAA7
+:100130003F0156702B5E712B722B732146013421C7
+:00000001FF
+)";
+    REQUIRE(hex.loads(input) == IntelHex::Result::SUCCESS);
+    auto stats = hex.stats();
+#ifdef INTELHEX_STATS
+    REQUIRE(stats.records == 5);
+    REQUIRE(stats.blocks == 1);
+    REQUIRE(stats.reallocations > 0);
+    REQUIRE(stats.total.count() > 0);
+    REQUIRE(stats.total >= stats.decode + stats.checksum + stats.building);
+#else
+    REQUIRE(stats.records == 0);
+    REQUIRE(stats.total.count() == 0);
+#endif
+}
+
+TEST_CASE("Accounting memory", "Memory")
+{
+    auto hex   = IntelHex();
+    auto input = R"(
+:10010000214601360121470136007EFE09D2190140
+:100110002146017E17C20001FF5F16002148011928
+:10012000194E79234623965778239EDA3F01B2CAA7
+:00000001FF
+)";
+    REQUIRE(hex.loads(input) == IntelHex::Result::SUCCESS);
+    auto usage = hex.memoryUsage();
+    REQUIRE(usage.payload == 0x30);
+    REQUIRE(usage.blocks == 1);
+    REQUIRE(usage.allocated > usage.payload);
+    REQUIRE(usage.overhead > 0);
+
+    hex.shrinkToFit();
+    usage = hex.memoryUsage();
+    REQUIRE(usage.payload == 0x30);
+    REQUIRE(usage.allocated == 0x30);
+    REQUIRE(hex.get(0x12F) == 0xCA);
+
+    // nothing but the end of file record leaves an empty block
+    hex = IntelHex();
+    REQUIRE(hex.loads(":00000001FF\n") == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.memoryUsage().blocks == 1);
+    hex.shrinkToFit();
+    REQUIRE(hex.memoryUsage().blocks == 0);
+    REQUIRE(hex.memoryUsage().allocated == 0);
+}
+
+TEST_CASE("Decoding literals at compile time", "Literal")
+{
+    static constexpr auto boot = parseHexLiteral(R"(
+        :10010000214601360121470136007EFE09D2190140
+        :100110002146017E17C20001FF5F16002148011928
+        :020000040001F9
+        :0400000501020304ED
+        :0100000042BD
+        :00000001FF
+    )");
+    static_assert(boot.error == IntelHex::ParseError::NONE);
+    static_assert(boot.blockCount == 2);
+    static_assert(boot.size == 0x21);
+    static_assert(boot.blocks[0].address == 0x0100 && boot.blocks[0].length == 0x20);
+    static_assert(boot.blocks[1].address == 0x10000 && boot.data[boot.blocks[1].offset] == 0x42);
+
+    auto hex = boot.image();
+    REQUIRE(hex.get(0x0100) == 0x21);
+    REQUIRE(hex.get(0x011F) == 0x19);
+    REQUIRE(hex.get(0x10000) == 0x42);
+
+    // the same literal decoded at runtime reports instead of failing to compile
+    auto broken = parseHexLiteral(":0100000042BE\n:00000001FF\n");
+    REQUIRE(broken.error == IntelHex::ParseError::BAD_CHECKSUM);
+    REQUIRE(broken.line == 1);
+    REQUIRE(parseHexLiteral(":0100000042BD\n").error == IntelHex::ParseError::MISSING_END);
+}
+
+#ifdef TEST_ENABLE_FILE_OPS
+TEST_CASE("Caching loaded images", "Cache")
+{
+    auto directory = fs::temp_directory_path() / "intelhex_cache";
+    fs::remove_all(directory);
+    auto path = corpusFile();
+
+    auto hex = IntelHex();
+    hex.setCacheDirectory(directory);
+    REQUIRE(hex.load(path) == IntelHex::Result::SUCCESS);
+    REQUIRE_FALSE(hex.loadedFromCache());
+    auto parsed = hex;
+
+    REQUIRE(hex.load(path) == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.loadedFromCache());
+    REQUIRE(IntelHex::diff(parsed, hex).empty());
+    REQUIRE(hex.minAddress() == 0x9D000000);
+    REQUIRE(hex.memoryUsage().mapped == hex.memoryUsage().payload);
+
+    // a hit after a failed load does not report the old error
+    auto bad = fs::temp_directory_path() / "intelhex_cache_bad.hex";
+    std::ofstream(bad) << ":0100000042BE\n:00000001FF\n";
+    REQUIRE(hex.load(bad) == IntelHex::Result::INCORRECT_FILE);
+    REQUIRE(hex.diagnostics().error == IntelHex::ParseError::BAD_CHECKSUM);
+    REQUIRE(hex.load(path) == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.loadedFromCache());
+    REQUIRE(hex.diagnostics().error == IntelHex::ParseError::NONE);
+    fs::remove(bad);
+
+    // same size and timestamp, different contents
+    auto mtime = fs::last_write_time(path);
+    {
+        CorpusOptions options;
+        options.size  = 0x30000;
+        options.start = 0x9D000000;
+        options.chunk = 0x3000;
+        options.gap   = 0x1000;
+        options.seed  = 2;
+        std::ofstream file(path, std::ios::binary);
+        generateCorpus(options, file);
+    }
+    fs::last_write_time(path, mtime);
+    REQUIRE(hex.load(path) == IntelHex::Result::SUCCESS);
+    REQUIRE_FALSE(hex.loadedFromCache());
+    REQUIRE_FALSE(IntelHex::diff(parsed, hex).empty());
+    REQUIRE(hex.load(path) == IntelHex::Result::SUCCESS);
+    REQUIRE(hex.loadedFromCache());
+
+    // parser settings are part of the key
+    hex.setStrict(false);
+    REQUIRE(hex.load(path) == IntelHex::Result::SUCCESS);
+    REQUIRE_FALSE(hex.loadedFromCache());
+
+    hex.setCacheDirectory({});
+    REQUIRE(hex.load(path) == IntelHex::Result::SUCCESS);
+    REQUIRE_FALSE(hex.loadedFromCache());
+
+    // the UF2 family ID comes back from the cache with the blocks
+    auto uf2Path = fs::temp_directory_path() / "intelhex_cache.uf2";
+    hex.setUf2FamilyId(0xE48BFF56);
+    REQUIRE(hex.save(uf2Path, IntelHex::Format::UF2) == IntelHex::Result::SUCCESS);
+    for (bool fromCache : {false, true}) {
+        auto uf2 = IntelHex();
+        uf2.setCacheDirectory(directory);
+        REQUIRE(uf2.load(uf2Path) == IntelHex::Result::SUCCESS);
+        REQUIRE(uf2.loadedFromCache() == fromCache);
+        REQUIRE(uf2.uf2FamilyId() == 0xE48BFF56);
+    }
+
+    fs::remove(uf2Path);
+    fs::remove(path);
+    fs::remove_all(directory);
+}
+#endif
+
+#ifdef TEST_ENABLE_FILE_OPS
+TEST_CASE("Saving native images", "Native")
+{
+    auto hex    = IntelHex();
+    auto corpus = corpusFile();
+    REQUIRE(hex.load(corpus) == IntelHex::Result::SUCCESS);
+    hex.write(0x10, reinterpret_cast<const uint8_t *>("\x01\x02\x03"), 3);
+    auto path = fs::temp_directory_path() / "intelhex_native.ihxn";
+    REQUIRE(hex.save(path, IntelHex::Format::NATIVE) == IntelHex::Result::SUCCESS);
+
+    auto mapped = IntelHex();
+    REQUIRE(mapped.load(path) == IntelHex::Result::SUCCESS);
+    REQUIRE(IntelHex::diff(hex, mapped).empty());
+    auto usage = mapped.memoryUsage();
+    REQUIRE(usage.mapped == usage.payload);
+    REQUIRE(usage.allocated == 0);
+
+    // writes stay in the image, growing or copying a block moves it to the heap
+    auto copy = mapped;
+    mapped[0x9D000000] ^= 0xFF;
+    mapped.write(0x9D02F000, reinterpret_cast<const uint8_t *>("\xAA"), 1);
+    REQUIRE(copy.memoryUsage().mapped == 0);
+    REQUIRE(mapped.memoryUsage().mapped < usage.mapped);
+    REQUIRE(IntelHex::diff(copy, mapped).size() == 2);
+    mapped.erase(0x9D000000, 0x100);
+    REQUIRE(mapped.minAddress() == 0x10);
+
+    auto reloaded = IntelHex();
+    REQUIRE(reloaded.load(path, IntelHex::Format::NATIVE) == IntelHex::Result::SUCCESS);
+    REQUIRE(IntelHex::diff(hex, reloaded).empty());
+
+    // read from memory the blocks are copied
+    std::ifstream file(path, std::ios::binary);
+    std::string native((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    auto parsed = IntelHex();
+    REQUIRE(parsed.loads(native) == IntelHex::Result::SUCCESS);
+    REQUIRE(parsed.memoryUsage().mapped == 0);
+    REQUIRE(IntelHex::diff(hex, parsed).empty());
+    REQUIRE(IntelHex().loads(native.substr(0, native.size() - 1)) == IntelHex::Result::INCORRECT_FILE);
+    native[32] ^= 0x01; // payload total
+    REQUIRE(IntelHex().loads(native) == IntelHex::Result::INCORRECT_FILE);
+
+    // saving an edited image over the file it still maps
+    auto edited = IntelHex();
+    REQUIRE(edited.load(path) == IntelHex::Result::SUCCESS);
+    REQUIRE(edited.memoryUsage().mapped > 0);
+    edited[0x9D000000] ^= 0xFF;
+    REQUIRE(edited.save(path, IntelHex::Format::NATIVE) == IntelHex::Result::SUCCESS);
+    REQUIRE(IntelHex::diff(hex, reloaded).empty());
+    auto saved = IntelHex();
+    REQUIRE(saved.load(path) == IntelHex::Result::SUCCESS);
+    REQUIRE(IntelHex::diff(edited, saved).empty());
+    REQUIRE(IntelHex::diff(hex, saved).size() == 1);
+    fs::remove(path);
+    fs::remove(corpus);
+}
+#endif